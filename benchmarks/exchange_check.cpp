@@ -0,0 +1,132 @@
+/**
+ *  @file
+ *  @copyright defined in fsc/LICENSE.txt
+ *
+ *  Compares the integer bancor conversions of exchange_state against the original double based
+ *  formulas over a sweep of market states.
+ *
+ *  usage: exchange_check [--samples N] [--seed N]
+ */
+#include <fscio.system/exchange_state.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+using namespace fsciosystem;
+
+namespace {
+
+   const symbol ramcore_sym{ "RAMCORE", 4 };
+   const symbol ram_sym{ "RAM", 0 };
+   const symbol core_sym{ "FSC", 4 };
+
+   /// the formulas exchange_state used before the integer path, kept as the reference
+   int64_t reference_to_exchange( int64_t supply, int64_t balance, int64_t in ) {
+      double R(supply);
+      double C(balance + in);
+      double T(in);
+      return int64_t( -R * ( 1.0 - std::pow( 1.0 + T / C, 0.5 ) ) );
+   }
+
+   int64_t reference_from_exchange( int64_t supply, int64_t balance, int64_t in ) {
+      double R(supply - in);
+      double C(balance);
+      double E(in);
+      return int64_t( C * ( std::pow( 1.0 + E / R, 2.0 ) - 1.0 ) );
+   }
+
+   /// core -> RAM through the supply token, as convert() did before the direct path
+   int64_t reference_convert( int64_t supply, int64_t ram, int64_t core, int64_t in ) {
+      int64_t issued = reference_to_exchange( supply, core, in );
+      return reference_from_exchange( supply + issued, ram, issued );
+   }
+
+   exchange_state make_market( int64_t supply, int64_t ram, int64_t core ) {
+      exchange_state m;
+      m.supply        = asset( supply, ramcore_sym );
+      m.base.balance  = asset( ram, ram_sym );
+      m.quote.balance = asset( core, core_sym );
+      return m;
+   }
+
+   struct stats {
+      uint64_t samples   = 0;
+      uint64_t different = 0;
+      uint64_t above     = 0; ///< integer result larger than the reference
+      int64_t  max_diff  = 0;
+
+      void add( int64_t integer, int64_t reference ) {
+         ++samples;
+         auto diff = integer - reference;
+         if( diff != 0 ) ++different;
+         if( diff > 0 ) ++above;
+         max_diff = std::max<int64_t>( max_diff, std::llabs( diff ) );
+      }
+
+      void report( const char* label )const {
+         printf( "%-18s %10llu samples %10llu differ %10llu above reference  max |diff| %lld\n", label,
+                 (unsigned long long)samples, (unsigned long long)different, (unsigned long long)above,
+                 (long long)max_diff );
+      }
+   };
+
+}
+
+int main( int argc, char** argv ) {
+   uint64_t samples = 1000000;
+   uint64_t seed    = 1;
+   for( int i = 1; i + 1 < argc; i += 2 ) {
+      std::string arg = argv[i];
+      if( arg == "--samples" ) samples = strtoull( argv[i+1], nullptr, 10 );
+      else if( arg == "--seed" ) seed = strtoull( argv[i+1], nullptr, 10 );
+   }
+
+   std::mt19937_64 rng( seed );
+   auto uniform = [&]( int64_t lo, int64_t hi ) { return lo + int64_t( rng() % uint64_t( hi - lo + 1 ) ); };
+
+   stats to_exchange, from_exchange, direct;
+   uint64_t inverse_failures = 0;
+   for( uint64_t i = 0; i < samples; ++i ) {
+      const int64_t supply = uniform( 1'000'000'000'0000ll, 100'000'000'000'0000ll );
+      const int64_t ram    = uniform( 1ll << 20, 1ll << 40 );
+      const int64_t core   = uniform( 1'0000ll, 100'000'000'0000ll );
+
+      const int64_t in_core = uniform( 1, core );
+      auto m = make_market( supply, ram, core );
+      to_exchange.add( m.convert_to_exchange( m.quote, asset( in_core, core_sym ) ).amount,
+                       reference_to_exchange( supply, core, in_core ) );
+
+      const int64_t in_ramcore = uniform( 1, supply / 100 );
+      m = make_market( supply, ram, core );
+      from_exchange.add( m.convert_from_exchange( m.base, asset( in_ramcore, ramcore_sym ) ).amount,
+                         reference_from_exchange( supply, ram, in_ramcore ) );
+
+      m = make_market( supply, ram, core );
+      direct.add( m.convert( asset( in_core, core_sym ), ram_sym ).amount,
+                  reference_convert( supply, ram, core, in_core ) );
+
+      /// required_input must buy at least the requested bytes, and one unit less must not
+      const int64_t want = uniform( 1, ram / 2 );
+      m = make_market( supply, ram, core );
+      const auto cost = m.required_input( asset( want, ram_sym ), core_sym );
+      auto enough = m;
+      auto short_one = m;
+      if( enough.convert( cost, ram_sym ).amount < want ||
+          ( cost.amount > 1 && short_one.convert( asset( cost.amount - 1, core_sym ), ram_sym ).amount >= want ) ) {
+         ++inverse_failures;
+      }
+   }
+
+   to_exchange.report( "convert_to_exchange" );
+   from_exchange.report( "convert_from_exchange" );
+   direct.report( "convert core->RAM" );
+   printf( "required_input     %10llu samples %10llu not minimal or short\n", (unsigned long long)samples,
+           (unsigned long long)inverse_failures );
+
+   /// the integer path rounds down exactly, the reference may only disagree by its own rounding error;
+   /// the direct conversion skips the intermediate truncation, so it may only ever pay out more
+   return ( to_exchange.max_diff > 1 || from_exchange.max_diff > 1 || inverse_failures ) ? 1 : 0;
+}
@@ -0,0 +1,404 @@
+/**
+ *  @file
+ *  @copyright defined in fsc/LICENSE.txt
+ *
+ *  Host definitions of the chain intrinsics the contracts import. They are exported from the benchmark
+ *  executable and resolved by the natively compiled contract modules when those are loaded.
+ */
+#include "native_chain.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+using fscio_native::current_chain;
+using fscio_native::assert_failure;
+using fscio_native::uint128_t;
+
+typedef uint64_t capi_name;
+typedef __int128 int128_t;
+struct capi_checksum256 { uint8_t hash[32]; };
+
+namespace {
+   auto& db() { return current_chain().db(); }
+
+   template<typename Key>
+   Key load_key( const void* p ) {
+      Key k;
+      memcpy( &k, p, sizeof(Key) );
+      return k;
+   }
+
+   void print( const std::string& s ) {
+      if( current_chain().print_enabled ) fputs( s.c_str(), stdout );
+   }
+
+   void sha256_block( const uint32_t in[16], uint32_t state[8] ) {
+      static const uint32_t k[64] = {
+         0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+         0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+         0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+         0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+         0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+         0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+         0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+         0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2 };
+      auto rotr = []( uint32_t x, uint32_t n ) { return ( x >> n ) | ( x << ( 32 - n ) ); };
+      uint32_t w[64];
+      for( int i = 0; i < 16; ++i ) w[i] = in[i];
+      for( int i = 16; i < 64; ++i ) {
+         uint32_t s0 = rotr( w[i-15], 7 ) ^ rotr( w[i-15], 18 ) ^ ( w[i-15] >> 3 );
+         uint32_t s1 = rotr( w[i-2], 17 ) ^ rotr( w[i-2], 19 ) ^ ( w[i-2] >> 10 );
+         w[i] = w[i-16] + s0 + w[i-7] + s1;
+      }
+      uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+      for( int i = 0; i < 64; ++i ) {
+         uint32_t t1 = h + ( rotr( e, 6 ) ^ rotr( e, 11 ) ^ rotr( e, 25 ) ) + ( ( e & f ) ^ ( ~e & g ) ) + k[i] + w[i];
+         uint32_t t2 = ( rotr( a, 2 ) ^ rotr( a, 13 ) ^ rotr( a, 22 ) ) + ( ( a & b ) ^ ( a & c ) ^ ( b & c ) );
+         h = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+      }
+      state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+      state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+   }
+}
+
+namespace fscio_native {
+   void sha256( const char* data, uint32_t length, uint8_t out[32] ) {
+      uint32_t state[8] = { 0x6a09e667,0xbb67ae85,0x3c6ef372,0xa54ff53a,0x510e527f,0x9b05688c,0x1f83d9ab,0x5be0cd19 };
+      std::string msg( data, length );
+      msg.push_back( char(0x80) );
+      while( msg.size() % 64 != 56 ) msg.push_back( 0 );
+      uint64_t bits = uint64_t(length) * 8;
+      for( int i = 7; i >= 0; --i ) msg.push_back( char( bits >> ( i * 8 ) ) );
+      for( size_t off = 0; off < msg.size(); off += 64 ) {
+         uint32_t block[16];
+         for( int i = 0; i < 16; ++i ) {
+            const auto* p = reinterpret_cast<const uint8_t*>( msg.data() + off + i * 4 );
+            block[i] = ( uint32_t(p[0]) << 24 ) | ( uint32_t(p[1]) << 16 ) | ( uint32_t(p[2]) << 8 ) | p[3];
+         }
+         sha256_block( block, state );
+      }
+      for( int i = 0; i < 8; ++i ) {
+         out[i*4]   = uint8_t( state[i] >> 24 );
+         out[i*4+1] = uint8_t( state[i] >> 16 );
+         out[i*4+2] = uint8_t( state[i] >> 8 );
+         out[i*4+3] = uint8_t( state[i] );
+      }
+   }
+}
+
+extern "C" {
+
+   /// system.h
+   void fscio_assert( uint32_t test, const char* msg ) {
+      if( !test ) throw assert_failure( msg );
+   }
+
+   void fscio_assert_message( uint32_t test, const char* msg, uint32_t msg_len ) {
+      if( !test ) throw assert_failure( std::string( msg, msg_len ) );
+   }
+
+   void fscio_assert_code( uint32_t test, uint64_t code ) {
+      if( !test ) throw assert_failure( "assertion failure with error code: " + std::to_string( code ) );
+   }
+
+   void fscio_exit( int32_t ) {
+      fscio_native::throw_exit();
+   }
+
+   uint64_t current_time() {
+      return current_chain().now();
+   }
+
+   /// action.h
+   uint32_t read_action_data( void* msg, uint32_t len ) {
+      const auto& data = current_chain().context().act->data;
+      auto copy_size = std::min<size_t>( len, data.size() );
+      memcpy( msg, data.data(), copy_size );
+      return uint32_t(copy_size);
+   }
+
+   uint32_t action_data_size() {
+      return uint32_t(current_chain().context().act->data.size());
+   }
+
+   void require_recipient( capi_name name ) {
+      current_chain().require_recipient( name );
+   }
+
+   void require_auth( capi_name name ) {
+      current_chain().require_auth( name );
+   }
+
+   void require_auth2( capi_name name, capi_name permission ) {
+      current_chain().require_auth( name, permission );
+   }
+
+   bool has_auth( capi_name name ) {
+      return current_chain().has_auth( name );
+   }
+
+   bool is_account( capi_name name ) {
+      return current_chain().is_account( name );
+   }
+
+   void send_inline( char* serialized_action, size_t size ) {
+      current_chain().send_inline( serialized_action, size );
+   }
+
+   void send_context_free_inline( char* serialized_action, size_t size ) {
+      current_chain().send_inline( serialized_action, size );
+   }
+
+   uint64_t publication_time() {
+      return current_chain().now();
+   }
+
+   capi_name current_receiver() {
+      return current_chain().context().receiver;
+   }
+
+   /// transaction.h
+   void send_deferred( const uint128_t&, capi_name payer, const char*, size_t, uint32_t ) {
+      current_chain().send_deferred( payer );
+   }
+
+   int cancel_deferred( const uint128_t& ) {
+      return current_chain().cancel_deferred();
+   }
+
+   /// privileged.h
+   void get_resource_limits( capi_name account, int64_t* ram_bytes, int64_t* net_weight, int64_t* cpu_weight ) {
+      const auto& l = current_chain().limits( account );
+      *ram_bytes  = l.ram;
+      *net_weight = l.net;
+      *cpu_weight = l.cpu;
+   }
+
+   void set_resource_limits( capi_name account, int64_t ram_bytes, int64_t net_weight, int64_t cpu_weight ) {
+      auto& l = current_chain().limits( account );
+      l.ram = ram_bytes;
+      l.net = net_weight;
+      l.cpu = cpu_weight;
+   }
+
+   int64_t set_proposed_producers( char* producer_data, uint32_t producer_data_size ) {
+      return current_chain().set_proposed_producers( producer_data, producer_data_size );
+   }
+
+   bool is_privileged( capi_name account ) {
+      return current_chain().is_privileged( account );
+   }
+
+   void set_privileged( capi_name account, bool is_priv ) {
+      current_chain().set_privileged( account, is_priv );
+   }
+
+   void set_blockchain_parameters_packed( char* data, uint32_t datalen ) {
+      current_chain().blockchain_parameters().assign( data, data + datalen );
+   }
+
+   uint32_t get_blockchain_parameters_packed( char* data, uint32_t datalen ) {
+      const auto& params = current_chain().blockchain_parameters();
+      if( datalen == 0 ) return uint32_t(params.size());
+      auto copy_size = std::min<size_t>( datalen, params.size() );
+      memcpy( data, params.data(), copy_size );
+      return uint32_t(copy_size);
+   }
+
+   /// crypto.h
+   void sha256( const char* data, uint32_t length, capi_checksum256* hash ) {
+      fscio_native::sha256( data, length, hash->hash );
+   }
+
+   void assert_sha256( const char* data, uint32_t length, const capi_checksum256* hash ) {
+      capi_checksum256 result;
+      fscio_native::sha256( data, length, result.hash );
+      if( memcmp( result.hash, hash->hash, 32 ) != 0 ) throw assert_failure( "hash mismatch" );
+   }
+
+   /// permission.h; the host does not model keys or permissions, so every proposal is authorized
+   int32_t check_transaction_authorization( const char*, uint32_t, const char*, uint32_t, const char*, uint32_t ) {
+      return 1;
+   }
+
+   /// print.h
+   void prints( const char* cstr ) { print( cstr ); }
+   void prints_l( const char* cstr, uint32_t len ) { print( std::string( cstr, len ) ); }
+   void printi( int64_t value ) { print( std::to_string( value ) ); }
+   void printui( uint64_t value ) { print( std::to_string( value ) ); }
+   void printsf( float value ) { print( std::to_string( value ) ); }
+   void printdf( double value ) { print( std::to_string( value ) ); }
+   void printqf( const long double* value ) { print( std::to_string( *value ) ); }
+
+   void printi128( const int128_t* value ) {
+      print( std::to_string( int64_t(*value) ) );
+   }
+
+   void printui128( const uint128_t* value ) {
+      print( std::to_string( uint64_t(*value) ) );
+   }
+
+   void printn( uint64_t name ) {
+      static const char* charmap = ".12345abcdefghijklmnopqrstuvwxyz";
+      std::string str( 13, '.' );
+      uint64_t tmp = name;
+      for( uint32_t i = 0; i <= 12; ++i ) {
+         char c = charmap[tmp & ( i == 0 ? 0x0f : 0x1f )];
+         str[12 - i] = c;
+         tmp >>= ( i == 0 ? 4 : 5 );
+      }
+      str.erase( str.find_last_not_of( '.' ) + 1 );
+      print( str );
+   }
+
+   void printhex( const void* data, uint32_t datalen ) {
+      static const char* hex = "0123456789abcdef";
+      std::string str;
+      const auto* p = static_cast<const uint8_t*>( data );
+      for( uint32_t i = 0; i < datalen; ++i ) {
+         str.push_back( hex[p[i] >> 4] );
+         str.push_back( hex[p[i] & 0x0f] );
+      }
+      print( str );
+   }
+
+   /// db.h: primary index
+   int32_t db_store_i64( uint64_t scope, capi_name table, capi_name payer, uint64_t id, const void* data, uint32_t len ) {
+      return db().store( current_receiver(), scope, table, payer, id, data, len );
+   }
+
+   void db_update_i64( int32_t iterator, capi_name payer, const void* data, uint32_t len ) {
+      db().update( current_receiver(), iterator, payer, data, len );
+   }
+
+   void db_remove_i64( int32_t iterator ) {
+      db().remove( current_receiver(), iterator );
+   }
+
+   int32_t db_get_i64( int32_t iterator, void* data, uint32_t len ) {
+      return db().get( iterator, data, len );
+   }
+
+   int32_t db_next_i64( int32_t iterator, uint64_t* primary ) {
+      return db().next( iterator, primary );
+   }
+
+   int32_t db_previous_i64( int32_t iterator, uint64_t* primary ) {
+      return db().previous( iterator, primary );
+   }
+
+   int32_t db_find_i64( capi_name code, uint64_t scope, capi_name table, uint64_t id ) {
+      return db().find( code, scope, table, id );
+   }
+
+   int32_t db_lowerbound_i64( capi_name code, uint64_t scope, capi_name table, uint64_t id ) {
+      return db().lowerbound( code, scope, table, id );
+   }
+
+   int32_t db_upperbound_i64( capi_name code, uint64_t scope, capi_name table, uint64_t id ) {
+      return db().upperbound( code, scope, table, id );
+   }
+
+   int32_t db_end_i64( capi_name code, uint64_t scope, capi_name table ) {
+      return db().end( code, scope, table );
+   }
+
+} /// extern "C"
+
+/// db.h: secondary indices; every kind exposes the same twelve entry points
+#define FSCIO_NATIVE_SECONDARY_INDEX( IDX, INDEX, KEY_TYPE, KEY_PARAM )                                                       \
+extern "C" {                                                                                                                   \
+   int32_t db_##IDX##_store( uint64_t scope, capi_name table, capi_name payer, uint64_t id, const KEY_PARAM* secondary ) {     \
+      return db().INDEX.store( current_receiver(), scope, table, payer, id, load_key<KEY_TYPE>( secondary ) );                \
+   }                                                                                                                           \
+   void db_##IDX##_update( int32_t iterator, capi_name payer, const KEY_PARAM* secondary ) {                                   \
+      db().INDEX.update( current_receiver(), iterator, payer, load_key<KEY_TYPE>( secondary ) );                               \
+   }                                                                                                                           \
+   void db_##IDX##_remove( int32_t iterator ) {                                                                                \
+      db().INDEX.remove( current_receiver(), iterator );                                                                       \
+   }                                                                                                                           \
+   int32_t db_##IDX##_next( int32_t iterator, uint64_t* primary ) {                                                            \
+      return db().INDEX.next( iterator, primary );                                                                             \
+   }                                                                                                                           \
+   int32_t db_##IDX##_previous( int32_t iterator, uint64_t* primary ) {                                                        \
+      return db().INDEX.previous( iterator, primary );                                                                         \
+   }                                                                                                                           \
+   int32_t db_##IDX##_find_primary( capi_name code, uint64_t scope, capi_name table, KEY_PARAM* secondary, uint64_t primary ) { \
+      KEY_TYPE key{};                                                                                                          \
+      auto itr = db().INDEX.find_primary( code, scope, table, &key, primary );                                                 \
+      if( itr >= 0 ) memcpy( secondary, &key, sizeof(KEY_TYPE) );                                                             \
+      return itr;                                                                                                              \
+   }                                                                                                                           \
+   int32_t db_##IDX##_find_secondary( capi_name code, uint64_t scope, capi_name table, const KEY_PARAM* secondary, uint64_t* primary ) { \
+      return db().INDEX.find_secondary( code, scope, table, load_key<KEY_TYPE>( secondary ), primary );                        \
+   }                                                                                                                           \
+   int32_t db_##IDX##_lowerbound( capi_name code, uint64_t scope, capi_name table, KEY_PARAM* secondary, uint64_t* primary ) {  \
+      auto key = load_key<KEY_TYPE>( secondary );                                                                              \
+      auto itr = db().INDEX.lowerbound( code, scope, table, &key, primary );                                                   \
+      if( itr >= 0 ) memcpy( secondary, &key, sizeof(KEY_TYPE) );                                                             \
+      return itr;                                                                                                              \
+   }                                                                                                                           \
+   int32_t db_##IDX##_upperbound( capi_name code, uint64_t scope, capi_name table, KEY_PARAM* secondary, uint64_t* primary ) {  \
+      auto key = load_key<KEY_TYPE>( secondary );                                                                              \
+      auto itr = db().INDEX.upperbound( code, scope, table, &key, primary );                                                   \
+      if( itr >= 0 ) memcpy( secondary, &key, sizeof(KEY_TYPE) );                                                             \
+      return itr;                                                                                                              \
+   }                                                                                                                           \
+   int32_t db_##IDX##_end( capi_name code, uint64_t scope, capi_name table ) {                                                 \
+      return db().INDEX.end( code, scope, table );                                                                             \
+   }                                                                                                                           \
+}
+
+FSCIO_NATIVE_SECONDARY_INDEX( idx64,           idx64,           uint64_t,                    uint64_t )
+FSCIO_NATIVE_SECONDARY_INDEX( idx128,          idx128,          uint128_t,                   uint128_t )
+FSCIO_NATIVE_SECONDARY_INDEX( idx_double,      idx_double,      double,                      double )
+FSCIO_NATIVE_SECONDARY_INDEX( idx_long_double, idx_long_double, long double,                 long double )
+
+#undef FSCIO_NATIVE_SECONDARY_INDEX
+
+/// idx256 passes its key as an array of uint128_t with an explicit length
+extern "C" {
+   typedef std::array<uint128_t,2> key256;
+
+   int32_t db_idx256_store( uint64_t scope, capi_name table, capi_name payer, uint64_t id, const uint128_t* data, uint32_t ) {
+      return db().idx256.store( current_receiver(), scope, table, payer, id, load_key<key256>( data ) );
+   }
+   void db_idx256_update( int32_t iterator, capi_name payer, const uint128_t* data, uint32_t ) {
+      db().idx256.update( current_receiver(), iterator, payer, load_key<key256>( data ) );
+   }
+   void db_idx256_remove( int32_t iterator ) {
+      db().idx256.remove( current_receiver(), iterator );
+   }
+   int32_t db_idx256_next( int32_t iterator, uint64_t* primary ) {
+      return db().idx256.next( iterator, primary );
+   }
+   int32_t db_idx256_previous( int32_t iterator, uint64_t* primary ) {
+      return db().idx256.previous( iterator, primary );
+   }
+   int32_t db_idx256_find_primary( capi_name code, uint64_t scope, capi_name table, uint128_t* data, uint32_t, uint64_t primary ) {
+      key256 key{};
+      auto itr = db().idx256.find_primary( code, scope, table, &key, primary );
+      if( itr >= 0 ) memcpy( data, &key, sizeof(key256) );
+      return itr;
+   }
+   int32_t db_idx256_find_secondary( capi_name code, uint64_t scope, capi_name table, const uint128_t* data, uint32_t, uint64_t* primary ) {
+      return db().idx256.find_secondary( code, scope, table, load_key<key256>( data ), primary );
+   }
+   int32_t db_idx256_lowerbound( capi_name code, uint64_t scope, capi_name table, uint128_t* data, uint32_t, uint64_t* primary ) {
+      auto key = load_key<key256>( data );
+      auto itr = db().idx256.lowerbound( code, scope, table, &key, primary );
+      if( itr >= 0 ) memcpy( data, &key, sizeof(key256) );
+      return itr;
+   }
+   int32_t db_idx256_upperbound( capi_name code, uint64_t scope, capi_name table, uint128_t* data, uint32_t, uint64_t* primary ) {
+      auto key = load_key<key256>( data );
+      auto itr = db().idx256.upperbound( code, scope, table, &key, primary );
+      if( itr >= 0 ) memcpy( data, &key, sizeof(key256) );
+      return itr;
+   }
+   int32_t db_idx256_end( capi_name code, uint64_t scope, capi_name table ) {
+      return db().idx256.end( code, scope, table );
+   }
+}
@@ -0,0 +1,532 @@
+/**
+ *  @file
+ *  @copyright defined in fsc/LICENSE.txt
+ */
+#include "native_chain.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include <dlfcn.h>
+
+namespace fscio_native {
+
+   namespace {
+      void check( bool condition, const char* msg ) {
+         if( !condition ) throw assert_failure( msg );
+      }
+
+      /// the only part of fscio_exit the host needs: unwinding out of the contract
+      struct exit_request {};
+   }
+
+   /********************************************************************************
+    *  database: primary tables
+    ********************************************************************************/
+
+   database::database()
+   :idx64(*this), idx128(*this), idx256(*this), idx_double(*this), idx_long_double(*this) {
+   }
+
+   database::primary_table* database::find_table( uint64_t code, uint64_t scope, uint64_t table ) {
+      auto itr = _tables.find( table_id{ code, scope, table } );
+      return itr == _tables.end() ? nullptr : &itr->second;
+   }
+
+   int32_t database::add_iterator( primary_table* t, uint64_t primary ) {
+      _iterators.emplace_back( t, primary );
+      return int32_t(_iterators.size() - 1);
+   }
+
+   int32_t database::end_iterator( primary_table* t ) {
+      auto itr = std::find( _ends.begin(), _ends.end(), t );
+      if( itr == _ends.end() ) {
+         _ends.push_back( t );
+         itr = _ends.end() - 1;
+      }
+      return -int32_t(itr - _ends.begin()) - 2;
+   }
+
+   std::pair<database::primary_table*, uint64_t>& database::get_iterator( int32_t iterator ) {
+      check( iterator >= 0 && size_t(iterator) < _iterators.size(), "invalid iterator" );
+      auto& it = _iterators[size_t(iterator)];
+      check( it.first != nullptr, "dereference of deleted object" );
+      return it;
+   }
+
+   database::primary_table* database::get_end( int32_t iterator ) {
+      check( iterator < -1 && size_t(-iterator - 2) < _ends.size(), "not a valid end iterator" );
+      return _ends[size_t(-iterator - 2)];
+   }
+
+   int32_t database::find( uint64_t code, uint64_t scope, uint64_t table, uint64_t id ) {
+      auto t = find_table( code, scope, table );
+      if( !t ) return -1;
+      auto end_itr = end_iterator( t );
+      if( !t->rows.count( id ) ) return end_itr;
+      return add_iterator( t, id );
+   }
+
+   int32_t database::lowerbound( uint64_t code, uint64_t scope, uint64_t table, uint64_t id ) {
+      auto t = find_table( code, scope, table );
+      if( !t ) return -1;
+      auto end_itr = end_iterator( t );
+      auto itr = t->rows.lower_bound( id );
+      if( itr == t->rows.end() ) return end_itr;
+      return add_iterator( t, itr->first );
+   }
+
+   int32_t database::upperbound( uint64_t code, uint64_t scope, uint64_t table, uint64_t id ) {
+      auto t = find_table( code, scope, table );
+      if( !t ) return -1;
+      auto end_itr = end_iterator( t );
+      auto itr = t->rows.upper_bound( id );
+      if( itr == t->rows.end() ) return end_itr;
+      return add_iterator( t, itr->first );
+   }
+
+   int32_t database::end( uint64_t code, uint64_t scope, uint64_t table ) {
+      auto t = find_table( code, scope, table );
+      if( !t ) return -1;
+      return end_iterator( t );
+   }
+
+   int32_t database::next( int32_t iterator, uint64_t* primary ) {
+      if( iterator < -1 ) return -1; // cannot increment past end iterator of table
+      auto& it = get_iterator( iterator );
+      auto itr = it.first->rows.upper_bound( it.second );
+      if( itr == it.first->rows.end() ) return end_iterator( it.first );
+      *primary = itr->first;
+      return add_iterator( it.first, itr->first );
+   }
+
+   int32_t database::previous( int32_t iterator, uint64_t* primary ) {
+      if( iterator < -1 ) {
+         auto t = get_end( iterator );
+         if( t->rows.empty() ) return -1;
+         auto itr = std::prev( t->rows.end() );
+         *primary = itr->first;
+         return add_iterator( t, itr->first );
+      }
+      auto& it = get_iterator( iterator );
+      auto itr = it.first->rows.find( it.second );
+      if( itr == it.first->rows.begin() ) return -1;
+      --itr;
+      *primary = itr->first;
+      return add_iterator( it.first, itr->first );
+   }
+
+   int32_t database::get( int32_t iterator, void* data, uint32_t len ) {
+      auto& it = get_iterator( iterator );
+      const auto& value = it.first->rows.at( it.second ).value;
+      if( len == 0 ) return int32_t(value.size());
+      auto copy_size = std::min<size_t>( len, value.size() );
+      memcpy( data, value.data(), copy_size );
+      return int32_t(copy_size);
+   }
+
+   int32_t database::store( uint64_t code, uint64_t scope, uint64_t table, uint64_t payer, uint64_t id, const void* data, uint32_t len ) {
+      auto& t = _tables[table_id{ code, scope, table }];
+      t.id = table_id{ code, scope, table };
+      check( t.rows.count( id ) == 0, "key uniqueness violation" );
+      auto& r = t.rows[id];
+      r.payer = payer;
+      r.value.assign( static_cast<const char*>(data), static_cast<const char*>(data) + len );
+      auto tp = &t;
+      record_undo( [tp, id]() { tp->rows.erase( id ); } );
+      return add_iterator( tp, id );
+   }
+
+   void database::update( uint64_t code, int32_t iterator, uint64_t payer, const void* data, uint32_t len ) {
+      auto& it = get_iterator( iterator );
+      check( it.first->id.code == code, "db access violation" );
+      auto& r = it.first->rows.at( it.second );
+      auto tp = it.first;
+      auto id = it.second;
+      record_undo( [tp, id, old = r]() { tp->rows[id] = old; } );
+      if( payer ) r.payer = payer;
+      r.value.assign( static_cast<const char*>(data), static_cast<const char*>(data) + len );
+   }
+
+   void database::remove( uint64_t code, int32_t iterator ) {
+      auto& it = get_iterator( iterator );
+      check( it.first->id.code == code, "db access violation" );
+      auto tp = it.first;
+      auto id = it.second;
+      auto old = tp->rows.at( id );
+      tp->rows.erase( id );
+      record_undo( [tp, id, old]() { tp->rows[id] = old; } );
+      it.first = nullptr;
+   }
+
+   void database::clear_iterators() {
+      _iterators.clear();
+      _ends.clear();
+      idx64.clear_iterators();
+      idx128.clear_iterators();
+      idx256.clear_iterators();
+      idx_double.clear_iterators();
+      idx_long_double.clear_iterators();
+   }
+
+   void database::begin_undo() {
+      _undo.clear();
+      _undo_enabled = true;
+   }
+
+   void database::commit() {
+      _undo.clear();
+      _undo_enabled = false;
+   }
+
+   void database::rollback() {
+      for( auto itr = _undo.rbegin(); itr != _undo.rend(); ++itr ) (*itr)();
+      _undo.clear();
+      _undo_enabled = false;
+      clear_iterators();
+   }
+
+   size_t database::row_count()const {
+      size_t count = 0;
+      for( const auto& t : _tables ) count += t.second.rows.size();
+      return count;
+   }
+
+   /********************************************************************************
+    *  database: secondary indices
+    ********************************************************************************/
+
+   template<typename Key>
+   database::secondary_table<Key>* database::secondary_index<Key>::find_table( uint64_t code, uint64_t scope, uint64_t table ) {
+      auto itr = _tables.find( table_id{ code, scope, table } );
+      return itr == _tables.end() ? nullptr : &itr->second;
+   }
+
+   template<typename Key>
+   int32_t database::secondary_index<Key>::add_iterator( secondary_table<Key>* t, uint64_t primary ) {
+      _iterators.emplace_back( t, primary );
+      return int32_t(_iterators.size() - 1);
+   }
+
+   template<typename Key>
+   int32_t database::secondary_index<Key>::end_iterator( secondary_table<Key>* t ) {
+      auto itr = std::find( _ends.begin(), _ends.end(), t );
+      if( itr == _ends.end() ) {
+         _ends.push_back( t );
+         itr = _ends.end() - 1;
+      }
+      return -int32_t(itr - _ends.begin()) - 2;
+   }
+
+   template<typename Key>
+   std::pair<database::secondary_table<Key>*, uint64_t>& database::secondary_index<Key>::get_iterator( int32_t iterator ) {
+      check( iterator >= 0 && size_t(iterator) < _iterators.size(), "invalid secondary iterator" );
+      auto& it = _iterators[size_t(iterator)];
+      check( it.first != nullptr, "dereference of deleted object" );
+      return it;
+   }
+
+   template<typename Key>
+   database::secondary_table<Key>* database::secondary_index<Key>::get_end( int32_t iterator ) {
+      check( iterator < -1 && size_t(-iterator - 2) < _ends.size(), "not a valid end iterator" );
+      return _ends[size_t(-iterator - 2)];
+   }
+
+   template<typename Key>
+   int32_t database::secondary_index<Key>::store( uint64_t code, uint64_t scope, uint64_t table, uint64_t payer, uint64_t id, const Key& secondary ) {
+      auto& t = _tables[table_id{ code, scope, table }];
+      t.id = table_id{ code, scope, table };
+      check( t.by_primary.count( id ) == 0, "secondary key uniqueness violation" );
+      t.entries.emplace( secondary, id );
+      t.by_primary[id] = std::make_pair( secondary, payer );
+      auto tp = &t;
+      _db.record_undo( [tp, id, secondary]() {
+         tp->entries.erase( std::make_pair( secondary, id ) );
+         tp->by_primary.erase( id );
+      });
+      return add_iterator( tp, id );
+   }
+
+   template<typename Key>
+   void database::secondary_index<Key>::update( uint64_t code, int32_t iterator, uint64_t payer, const Key& secondary ) {
+      auto& it = get_iterator( iterator );
+      check( it.first->id.code == code, "db access violation" );
+      auto tp = it.first;
+      auto id = it.second;
+      auto old = tp->by_primary.at( id );
+      tp->entries.erase( std::make_pair( old.first, id ) );
+      tp->entries.emplace( secondary, id );
+      tp->by_primary[id] = std::make_pair( secondary, payer ? payer : old.second );
+      _db.record_undo( [tp, id, old, secondary]() {
+         tp->entries.erase( std::make_pair( secondary, id ) );
+         tp->entries.emplace( old.first, id );
+         tp->by_primary[id] = old;
+      });
+   }
+
+   template<typename Key>
+   void database::secondary_index<Key>::remove( uint64_t code, int32_t iterator ) {
+      auto& it = get_iterator( iterator );
+      check( it.first->id.code == code, "db access violation" );
+      auto tp = it.first;
+      auto id = it.second;
+      auto old = tp->by_primary.at( id );
+      tp->entries.erase( std::make_pair( old.first, id ) );
+      tp->by_primary.erase( id );
+      _db.record_undo( [tp, id, old]() {
+         tp->entries.emplace( old.first, id );
+         tp->by_primary[id] = old;
+      });
+      it.first = nullptr;
+   }
+
+   template<typename Key>
+   int32_t database::secondary_index<Key>::next( int32_t iterator, uint64_t* primary ) {
+      if( iterator < -1 ) return -1; // cannot increment past end iterator of index
+      auto& it = get_iterator( iterator );
+      auto tp = it.first;
+      auto itr = tp->entries.upper_bound( std::make_pair( tp->by_primary.at( it.second ).first, it.second ) );
+      if( itr == tp->entries.end() ) return end_iterator( tp );
+      *primary = itr->second;
+      return add_iterator( tp, itr->second );
+   }
+
+   template<typename Key>
+   int32_t database::secondary_index<Key>::previous( int32_t iterator, uint64_t* primary ) {
+      if( iterator < -1 ) {
+         auto tp = get_end( iterator );
+         if( tp->entries.empty() ) return -1;
+         auto itr = std::prev( tp->entries.end() );
+         *primary = itr->second;
+         return add_iterator( tp, itr->second );
+      }
+      auto& it = get_iterator( iterator );
+      auto tp = it.first;
+      auto itr = tp->entries.find( std::make_pair( tp->by_primary.at( it.second ).first, it.second ) );
+      if( itr == tp->entries.begin() ) return -1;
+      --itr;
+      *primary = itr->second;
+      return add_iterator( tp, itr->second );
+   }
+
+   template<typename Key>
+   int32_t database::secondary_index<Key>::find_primary( uint64_t code, uint64_t scope, uint64_t table, Key* secondary, uint64_t primary ) {
+      auto tp = find_table( code, scope, table );
+      if( !tp ) return -1;
+      auto end_itr = end_iterator( tp );
+      auto itr = tp->by_primary.find( primary );
+      if( itr == tp->by_primary.end() ) return end_itr;
+      *secondary = itr->second.first;
+      return add_iterator( tp, primary );
+   }
+
+   template<typename Key>
+   int32_t database::secondary_index<Key>::find_secondary( uint64_t code, uint64_t scope, uint64_t table, const Key& secondary, uint64_t* primary ) {
+      auto tp = find_table( code, scope, table );
+      if( !tp ) return -1;
+      auto end_itr = end_iterator( tp );
+      auto itr = tp->entries.lower_bound( std::make_pair( secondary, uint64_t(0) ) );
+      if( itr == tp->entries.end() || itr->first != secondary ) return end_itr;
+      *primary = itr->second;
+      return add_iterator( tp, itr->second );
+   }
+
+   template<typename Key>
+   int32_t database::secondary_index<Key>::lowerbound( uint64_t code, uint64_t scope, uint64_t table, Key* secondary, uint64_t* primary ) {
+      auto tp = find_table( code, scope, table );
+      if( !tp ) return -1;
+      auto end_itr = end_iterator( tp );
+      auto itr = tp->entries.lower_bound( std::make_pair( *secondary, uint64_t(0) ) );
+      if( itr == tp->entries.end() ) return end_itr;
+      *secondary = itr->first;
+      *primary = itr->second;
+      return add_iterator( tp, itr->second );
+   }
+
+   template<typename Key>
+   int32_t database::secondary_index<Key>::upperbound( uint64_t code, uint64_t scope, uint64_t table, Key* secondary, uint64_t* primary ) {
+      auto tp = find_table( code, scope, table );
+      if( !tp ) return -1;
+      auto end_itr = end_iterator( tp );
+      auto itr = tp->entries.upper_bound( std::make_pair( *secondary, std::numeric_limits<uint64_t>::max() ) );
+      if( itr == tp->entries.end() ) return end_itr;
+      *secondary = itr->first;
+      *primary = itr->second;
+      return add_iterator( tp, itr->second );
+   }
+
+   template<typename Key>
+   int32_t database::secondary_index<Key>::end( uint64_t code, uint64_t scope, uint64_t table ) {
+      auto tp = find_table( code, scope, table );
+      if( !tp ) return -1;
+      return end_iterator( tp );
+   }
+
+   template class database::secondary_index<uint64_t>;
+   template class database::secondary_index<uint128_t>;
+   template class database::secondary_index<std::array<uint128_t,2>>;
+   template class database::secondary_index<double>;
+   template class database::secondary_index<long double>;
+
+   /********************************************************************************
+    *  chain
+    ********************************************************************************/
+
+   chain::chain()
+   :_blockchain_parameters( 68, 0 ) {
+   }
+
+   void chain::load_contract( uint64_t account, const std::string& path ) {
+      void* handle = dlopen( path.c_str(), RTLD_NOW | RTLD_LOCAL );
+      if( !handle ) throw std::runtime_error( std::string("unable to load contract: ") + dlerror() );
+      auto apply = reinterpret_cast<apply_function>( dlsym( handle, "apply" ) );
+      if( !apply ) throw std::runtime_error( "contract " + path + " does not export apply" );
+      _contracts[account] = apply;
+      create_account( account );
+   }
+
+   void chain::create_account( uint64_t account ) {
+      _accounts.insert( account );
+   }
+
+   apply_context& chain::context() {
+      check( !_contexts.empty(), "intrinsic called outside of an action" );
+      return *_contexts.back();
+   }
+
+   void chain::require_auth( uint64_t account, uint64_t permission )const {
+      const auto& ctx = *_contexts.back();
+      for( const auto& p : ctx.act->authorization ) {
+         if( p.actor == account && ( permission == 0 || p.permission == 0 || p.permission == permission ) ) return;
+      }
+      throw assert_failure( "missing authority" );
+   }
+
+   bool chain::has_auth( uint64_t account )const {
+      const auto& ctx = *_contexts.back();
+      for( const auto& p : ctx.act->authorization ) {
+         if( p.actor == account ) return true;
+      }
+      return false;
+   }
+
+   void chain::require_recipient( uint64_t account ) {
+      auto& ctx = context();
+      if( std::find( ctx.recipients->begin(), ctx.recipients->end(), account ) == ctx.recipients->end() ) {
+         ctx.recipients->push_back( account );
+      }
+   }
+
+   namespace {
+      uint64_t read_varuint( const char*& pos, const char* end ) {
+         uint64_t v = 0;
+         uint8_t  b = 0;
+         uint32_t by = 0;
+         do {
+            check( pos < end, "read past end of packed action" );
+            b = uint8_t(*pos++);
+            v |= uint64_t(b & 0x7f) << by;
+            by += 7;
+         } while( b & 0x80 );
+         return v;
+      }
+
+      uint64_t read_u64( const char*& pos, const char* end ) {
+         check( end - pos >= 8, "read past end of packed action" );
+         uint64_t v;
+         memcpy( &v, pos, 8 );
+         pos += 8;
+         return v;
+      }
+   }
+
+   void chain::send_inline( const char* data, size_t size ) {
+      const char* pos = data;
+      const char* end = data + size;
+      action act;
+      act.account = read_u64( pos, end );
+      act.name    = read_u64( pos, end );
+      auto auth_count = read_varuint( pos, end );
+      for( uint64_t i = 0; i < auth_count; ++i ) {
+         permission_level p;
+         p.actor      = read_u64( pos, end );
+         p.permission = read_u64( pos, end );
+         act.authorization.push_back( p );
+      }
+      auto data_size = read_varuint( pos, end );
+      check( uint64_t(end - pos) >= data_size, "read past end of packed action" );
+      act.data.assign( pos, pos + data_size );
+      context().inline_actions->push_back( std::move(act) );
+   }
+
+   void chain::set_privileged( uint64_t account, bool is_priv ) {
+      if( is_priv ) _privileged.insert( account );
+      else _privileged.erase( account );
+   }
+
+   int64_t chain::set_proposed_producers( const char* data, uint32_t size ) {
+      _proposed_schedule.assign( data, data + size );
+      return int64_t(++_schedule_count);
+   }
+
+   void chain::execute( const action& act, uint32_t depth ) {
+      check( depth < 10, "max inline action depth exceeded" );
+      std::vector<uint64_t> recipients{ act.account };
+      std::vector<action>   inline_actions;
+      for( size_t i = 0; i < recipients.size(); ++i ) {
+         auto contract = _contracts.find( recipients[i] );
+         if( contract == _contracts.end() ) continue;
+
+         apply_context ctx{ recipients[i], &act, &recipients, &inline_actions };
+         _contexts.push_back( &ctx );
+         _db.clear_iterators();
+         try {
+            contract->second( recipients[i], act.account, act.name );
+         } catch( const exit_request& ) {
+         } catch( ... ) {
+            _contexts.pop_back();
+            throw;
+         }
+         _contexts.pop_back();
+      }
+      for( const auto& a : inline_actions ) {
+         execute( a, depth + 1 );
+      }
+   }
+
+   bool chain::push_transaction( const std::vector<action>& actions, std::string* error ) {
+      _db.begin_undo();
+      try {
+         for( const auto& act : actions ) {
+            execute( act, 0 );
+         }
+      } catch( const assert_failure& e ) {
+         _contexts.clear();
+         _db.rollback();
+         if( error ) *error = e.what();
+         return false;
+      }
+      _db.commit();
+      return true;
+   }
+
+   bool chain::push_action( uint64_t account, uint64_t name, uint64_t actor, std::vector<char> data, std::string* error ) {
+      action act;
+      act.account = account;
+      act.name    = name;
+      act.authorization.push_back( permission_level{ actor, 0 } );
+      act.data    = std::move(data);
+      return push_transaction( { act }, error );
+   }
+
+   chain& current_chain() {
+      static chain c;
+      return c;
+   }
+
+   void throw_exit() {
+      throw exit_request{};
+   }
+
+} /// namespace fscio_native
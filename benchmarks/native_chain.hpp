@@ -0,0 +1,239 @@
+/**
+ *  @file
+ *  @copyright defined in fsc/LICENSE.txt
+ */
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace fscio_native {
+
+   typedef unsigned __int128 uint128_t;
+
+   /**
+    *  Thrown by the fscio_assert family of intrinsics; a failed action rolls back the whole
+    *  transaction it belongs to.
+    */
+   struct assert_failure : std::runtime_error {
+      using std::runtime_error::runtime_error;
+   };
+
+   struct permission_level {
+      uint64_t actor      = 0;
+      uint64_t permission = 0;
+   };
+
+   struct action {
+      uint64_t                       account = 0;
+      uint64_t                       name    = 0;
+      std::vector<permission_level>  authorization;
+      std::vector<char>              data;
+   };
+
+   struct table_id {
+      uint64_t code  = 0;
+      uint64_t scope = 0;
+      uint64_t table = 0;
+
+      bool operator<( const table_id& o )const {
+         return std::tie( code, scope, table ) < std::tie( o.code, o.scope, o.table );
+      }
+   };
+
+   /**
+    *  In-memory stand-in for the chain database: primary tables are ordered maps keyed by primary key,
+    *  secondary indices are ordered sets of (secondary key, primary key). Iterators follow the chain
+    *  conventions: rows get non-negative handles, the end of a table is -(table handle + 2) and -1 is
+    *  an invalid iterator. Every write inside a transaction is recorded in an undo log.
+    */
+   class database {
+      public:
+         struct row {
+            uint64_t           payer = 0;
+            std::vector<char>  value;
+         };
+
+         struct primary_table {
+            table_id                   id;
+            std::map<uint64_t, row>    rows;
+         };
+
+         template<typename Key>
+         struct secondary_table {
+            table_id                                  id;
+            std::set<std::pair<Key, uint64_t>>        entries;
+            std::map<uint64_t, std::pair<Key,uint64_t>> by_primary; ///< primary -> (secondary, payer)
+         };
+
+         int32_t  find( uint64_t code, uint64_t scope, uint64_t table, uint64_t id );
+         int32_t  lowerbound( uint64_t code, uint64_t scope, uint64_t table, uint64_t id );
+         int32_t  upperbound( uint64_t code, uint64_t scope, uint64_t table, uint64_t id );
+         int32_t  end( uint64_t code, uint64_t scope, uint64_t table );
+         int32_t  next( int32_t iterator, uint64_t* primary );
+         int32_t  previous( int32_t iterator, uint64_t* primary );
+         int32_t  get( int32_t iterator, void* data, uint32_t len );
+         int32_t  store( uint64_t code, uint64_t scope, uint64_t table, uint64_t payer, uint64_t id, const void* data, uint32_t len );
+         void     update( uint64_t code, int32_t iterator, uint64_t payer, const void* data, uint32_t len );
+         void     remove( uint64_t code, int32_t iterator );
+
+         /**
+          *  One secondary index kind (idx64, idx128, idx256, idx_double, idx_long_double).
+          */
+         template<typename Key>
+         class secondary_index {
+            public:
+               secondary_index( database& db ) : _db(db) {}
+
+               int32_t store( uint64_t code, uint64_t scope, uint64_t table, uint64_t payer, uint64_t id, const Key& secondary );
+               void    update( uint64_t code, int32_t iterator, uint64_t payer, const Key& secondary );
+               void    remove( uint64_t code, int32_t iterator );
+               int32_t next( int32_t iterator, uint64_t* primary );
+               int32_t previous( int32_t iterator, uint64_t* primary );
+               int32_t find_primary( uint64_t code, uint64_t scope, uint64_t table, Key* secondary, uint64_t primary );
+               int32_t find_secondary( uint64_t code, uint64_t scope, uint64_t table, const Key& secondary, uint64_t* primary );
+               int32_t lowerbound( uint64_t code, uint64_t scope, uint64_t table, Key* secondary, uint64_t* primary );
+               int32_t upperbound( uint64_t code, uint64_t scope, uint64_t table, Key* secondary, uint64_t* primary );
+               int32_t end( uint64_t code, uint64_t scope, uint64_t table );
+
+               void    clear_iterators() { _iterators.clear(); _ends.clear(); }
+
+            private:
+               secondary_table<Key>* find_table( uint64_t code, uint64_t scope, uint64_t table );
+               int32_t               add_iterator( secondary_table<Key>* t, uint64_t primary );
+               int32_t               end_iterator( secondary_table<Key>* t );
+               std::pair<secondary_table<Key>*, uint64_t>& get_iterator( int32_t iterator );
+               secondary_table<Key>* get_end( int32_t iterator );
+
+               database&                                                 _db;
+               std::map<table_id, secondary_table<Key>>                  _tables;
+               std::vector<std::pair<secondary_table<Key>*, uint64_t>>   _iterators;
+               std::vector<secondary_table<Key>*>                        _ends;
+         };
+
+         database();
+
+         secondary_index<uint64_t>                  idx64;
+         secondary_index<uint128_t>                 idx128;
+         secondary_index<std::array<uint128_t,2>>   idx256;
+         secondary_index<double>                    idx_double;
+         secondary_index<long double>               idx_long_double;
+
+         /// iterators are only valid within one action
+         void clear_iterators();
+
+         void begin_undo();
+         void commit();
+         void rollback();
+         void record_undo( std::function<void()> undo ) { if( _undo_enabled ) _undo.push_back( std::move(undo) ); }
+
+         size_t row_count()const;
+
+      private:
+         primary_table* find_table( uint64_t code, uint64_t scope, uint64_t table );
+         int32_t        add_iterator( primary_table* t, uint64_t primary );
+         int32_t        end_iterator( primary_table* t );
+         std::pair<primary_table*, uint64_t>& get_iterator( int32_t iterator );
+         primary_table* get_end( int32_t iterator );
+
+         std::map<table_id, primary_table>                _tables;
+         std::vector<std::pair<primary_table*, uint64_t>> _iterators;
+         std::vector<primary_table*>                      _ends;
+
+         bool                                             _undo_enabled = false;
+         std::vector<std::function<void()>>               _undo;
+   };
+
+   typedef void (*apply_function)( uint64_t receiver, uint64_t code, uint64_t action );
+
+   /**
+    *  The state an action runs against: receiver, action and what it queued for after it.
+    */
+   struct apply_context {
+      uint64_t                 receiver = 0;
+      const action*            act      = nullptr;
+      std::vector<uint64_t>*   recipients = nullptr;
+      std::vector<action>*     inline_actions = nullptr;
+   };
+
+   struct resource_limits {
+      int64_t ram = -1;
+      int64_t net = -1;
+      int64_t cpu = -1;
+   };
+
+   /**
+    *  A single-node chain running natively compiled contracts. Contracts are shared objects exporting the
+    *  FSCIO_DISPATCH `apply` entry point; they resolve the chain intrinsics from the host executable.
+    */
+   class chain {
+      public:
+         chain();
+
+         void      load_contract( uint64_t account, const std::string& path );
+         void      create_account( uint64_t account );
+         bool      is_account( uint64_t account )const { return _accounts.count( account ) > 0; }
+
+         uint64_t  now()const { return _now; }
+         void      set_now( uint64_t microseconds ) { _now = microseconds; }
+         void      advance( uint64_t microseconds ) { _now += microseconds; }
+
+         /**
+          *  Runs `actions` as one transaction. On failure the database is rolled back and the assertion
+          *  message is stored in `error` when given.
+          */
+         bool      push_transaction( const std::vector<action>& actions, std::string* error = nullptr );
+         bool      push_action( uint64_t account, uint64_t name, uint64_t actor, std::vector<char> data, std::string* error = nullptr );
+
+         database&             db() { return _db; }
+         apply_context&        context();
+         void                  require_auth( uint64_t account, uint64_t permission = 0 )const;
+         bool                  has_auth( uint64_t account )const;
+         void                  require_recipient( uint64_t account );
+         void                  send_inline( const char* data, size_t size );
+         void                  send_deferred( uint64_t payer ) { ++_deferred_count; (void)payer; }
+         int                   cancel_deferred() { return 0; }
+
+         resource_limits&      limits( uint64_t account ) { return _limits[account]; }
+         bool                  is_privileged( uint64_t account )const { return _privileged.count( account ) > 0; }
+         void                  set_privileged( uint64_t account, bool is_priv );
+         std::vector<char>&    blockchain_parameters() { return _blockchain_parameters; }
+         int64_t               set_proposed_producers( const char* data, uint32_t size );
+
+         bool                  print_enabled = false;
+
+         uint64_t              deferred_count()const { return _deferred_count; }
+         uint64_t              schedule_count()const { return _schedule_count; }
+
+      private:
+         void execute( const action& act, uint32_t depth );
+
+         database                               _db;
+         std::map<uint64_t, apply_function>     _contracts;
+         std::set<uint64_t>                     _accounts;
+         std::set<uint64_t>                     _privileged;
+         std::map<uint64_t, resource_limits>    _limits;
+         std::vector<char>                      _blockchain_parameters;
+         std::vector<char>                      _proposed_schedule;
+         std::vector<apply_context*>            _contexts;
+         uint64_t                               _now = 0;
+         uint64_t                               _deferred_count = 0;
+         uint64_t                               _schedule_count = 0;
+   };
+
+   /// the chain the intrinsics operate on
+   chain& current_chain();
+
+   void sha256( const char* data, uint32_t length, uint8_t out[32] );
+
+   /// unwinds out of the running contract; used by fscio_exit
+   [[noreturn]] void throw_exit();
+
+} /// namespace fscio_native
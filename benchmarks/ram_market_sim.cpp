@@ -0,0 +1,194 @@
+/**
+ *  @file
+ *  @copyright defined in fsc/LICENSE.txt
+ *
+ *  Replays long sequences of buys and sells against a ram market seeded the way init seeds it and
+ *  reports conversions per second, the rounding drift left in the connectors and the profit of
+ *  round trip and split order strategies. Any of those going in favour of the traders is a failure.
+ *
+ *  usage: ram_market_sim [--ops N] [--seed N] [--core-supply N] [--ram-bytes N]
+ */
+#include <fscio.system/exchange_state.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace fsciosystem;
+
+namespace {
+
+   const symbol ramcore_sym{ "RAMCORE", 4 };
+   const symbol ram_sym{ "RAM", 0 };
+   const symbol core_sym{ "FSC", 4 };
+
+   typedef unsigned __int128 uint128_t;
+
+   /// same seeding as system_contract::init
+   exchange_state make_market( int64_t core_supply, int64_t ram_bytes ) {
+      exchange_state m;
+      m.supply        = asset( 100000000000000ll, ramcore_sym );
+      m.base.balance  = asset( ram_bytes, ram_sym );
+      m.quote.balance = asset( core_supply / 1000, core_sym );
+      return m;
+   }
+
+   int64_t buy( exchange_state& m, int64_t core ) {
+      return m.convert( asset( core, core_sym ), ram_sym ).amount;
+   }
+
+   int64_t sell( exchange_state& m, int64_t bytes ) {
+      return m.convert( asset( bytes, ram_sym ), core_sym ).amount;
+   }
+
+   uint128_t invariant( const exchange_state& m ) {
+      return uint128_t( m.base.balance.amount ) * uint128_t( m.quote.balance.amount );
+   }
+
+   struct scenario {
+      std::string name;
+      uint64_t    conversions      = 0;
+      double      seconds          = 0;
+      int64_t     core_in          = 0;  ///< core paid by the traders
+      int64_t     core_out         = 0;  ///< core received back once every position is closed
+      int64_t     best_profit      = 0;  ///< best single strategy outcome, must stay <= 0
+      uint64_t    invariant_breaks = 0;  ///< conversions after which base * quote went down
+
+      void report()const {
+         printf( "%-14s %10llu conversions %8.2f M/s  drift %+lld core  best strategy %+lld core  invariant breaks %llu\n",
+                 name.c_str(), (unsigned long long)conversions, seconds > 0 ? conversions / seconds / 1e6 : 0.0,
+                 (long long)( core_in - core_out ), (long long)best_profit, (unsigned long long)invariant_breaks );
+      }
+
+      bool failed()const {
+         return core_out > core_in || best_profit > 0 || invariant_breaks > 0;
+      }
+   };
+
+   /**
+    *  Runs fn( market, rng, s ) for ops iterations, then sells every byte still held so the core that
+    *  remains in the market measures the rounding drift of the whole sequence.
+    */
+   template<typename Step>
+   scenario run( const std::string& name, exchange_state market, uint64_t ops, uint64_t seed, Step&& step ) {
+      scenario s;
+      s.name = name;
+      std::mt19937_64 rng( seed );
+      std::vector<int64_t> holdings( 64, 0 );
+
+      auto checked = [&]( auto&& convert ) {
+         const auto before = invariant( market );
+         auto result = convert();
+         if( invariant( market ) < before ) ++s.invariant_breaks;
+         ++s.conversions;
+         return result;
+      };
+
+      const auto start = std::chrono::steady_clock::now();
+      for( uint64_t i = 0; i < ops; ++i ) {
+         step( market, rng, holdings, s, checked );
+      }
+      for( auto& held : holdings ) {
+         if( held > 0 ) {
+            s.core_out += checked( [&] { return sell( market, held ); } );
+            held = 0;
+         }
+      }
+      s.seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+      return s;
+   }
+
+}
+
+int main( int argc, char** argv ) {
+   uint64_t ops         = 1000000;
+   uint64_t seed        = 1;
+   int64_t  core_supply = 10'000'000'000'0000ll;
+   int64_t  ram_bytes   = 64ll * 1024 * 1024 * 1024;
+   for( int i = 1; i + 1 < argc; i += 2 ) {
+      std::string arg = argv[i];
+      if( arg == "--ops" ) ops = strtoull( argv[i+1], nullptr, 10 );
+      else if( arg == "--seed" ) seed = strtoull( argv[i+1], nullptr, 10 );
+      else if( arg == "--core-supply" ) core_supply = strtoll( argv[i+1], nullptr, 10 );
+      else if( arg == "--ram-bytes" ) ram_bytes = strtoll( argv[i+1], nullptr, 10 );
+   }
+
+   const auto market = make_market( core_supply, ram_bytes );
+   auto uniform = []( std::mt19937_64& rng, int64_t lo, int64_t hi ) {
+      return lo + int64_t( rng() % uint64_t( hi - lo + 1 ) );
+   };
+   std::vector<scenario> results;
+
+   /// random traders buying up to 1% of the core connector and selling random parts of what they hold
+   results.push_back( run( "random", market, ops, seed, [&]( auto& m, auto& rng, auto& holdings, auto& s, auto& checked ) {
+      auto& held = holdings[ rng() % holdings.size() ];
+      if( held == 0 || rng() % 2 ) {
+         const int64_t core = uniform( rng, 1, std::max<int64_t>( 1, m.quote.balance.amount / 100 ) );
+         s.core_in += core;
+         held += checked( [&] { return buy( m, core ); } );
+      } else {
+         const int64_t bytes = uniform( rng, 1, held );
+         s.core_out += checked( [&] { return sell( m, bytes ); } );
+         held -= bytes;
+      }
+   }));
+
+   /// dust trades where the truncation is a large part of every result
+   results.push_back( run( "dust", market, ops, seed, [&]( auto& m, auto& rng, auto& holdings, auto& s, auto& checked ) {
+      auto& held = holdings[ rng() % holdings.size() ];
+      if( held < 1024 || rng() % 2 ) {
+         const int64_t core = uniform( rng, 1, 100 );
+         s.core_in += core;
+         held += checked( [&] { return buy( m, core ); } );
+      } else {
+         const int64_t bytes = uniform( rng, 1, 1024 );
+         s.core_out += checked( [&] { return sell( m, bytes ); } );
+         held -= bytes;
+      }
+   }));
+
+   /// buy and immediately sell everything back, from dust up to half of the core connector
+   results.push_back( run( "round-trip", market, ops, seed, [&]( auto& m, auto& rng, auto&, auto& s, auto& checked ) {
+      const int64_t core = int64_t( 1 ) << uniform( rng, 0, 62 );
+      const int64_t clamped = std::min<int64_t>( core, m.quote.balance.amount / 2 );
+      const int64_t bytes = checked( [&] { return buy( m, clamped ); } );
+      const int64_t back  = bytes > 0 ? checked( [&] { return sell( m, bytes ); } ) : 0;
+      s.core_in  += clamped;
+      s.core_out += back;
+      s.best_profit = std::max( s.best_profit, back - clamped );
+   }));
+
+   /// split a purchase into many pieces and sell it back whole, and the other way around
+   results.push_back( run( "split", market, ops / 64, seed, [&]( auto& m, auto& rng, auto&, auto& s, auto& checked ) {
+      const int64_t pieces = uniform( rng, 2, 64 );
+      const int64_t piece  = uniform( rng, 1, std::max<int64_t>( 1, m.quote.balance.amount / 1000 ) );
+      int64_t bytes = 0;
+      for( int64_t p = 0; p < pieces; ++p ) bytes += checked( [&] { return buy( m, piece ); } );
+      const int64_t back = bytes > 0 ? checked( [&] { return sell( m, bytes ); } ) : 0;
+      s.core_in  += piece * pieces;
+      s.core_out += back;
+      s.best_profit = std::max( s.best_profit, back - piece * pieces );
+
+      const int64_t core   = piece * pieces;
+      const int64_t bought = checked( [&] { return buy( m, core ); } );
+      int64_t returned = 0;
+      for( int64_t p = 0; p < pieces; ++p ) {
+         const int64_t part = p + 1 < pieces ? bought / pieces : bought - ( bought / pieces ) * ( pieces - 1 );
+         if( part > 0 ) returned += checked( [&] { return sell( m, part ); } );
+      }
+      s.core_in  += core;
+      s.core_out += returned;
+      s.best_profit = std::max( s.best_profit, returned - core );
+   }));
+
+   bool failed = false;
+   for( const auto& s : results ) {
+      s.report();
+      failed |= s.failed();
+   }
+   return failed ? 1 : 0;
+}
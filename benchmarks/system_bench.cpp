@@ -0,0 +1,235 @@
+/**
+ *  @file
+ *  @copyright defined in fsc/LICENSE.txt
+ *
+ *  Times the hot system contract actions against the natively compiled contracts.
+ *
+ *  usage: system_bench [--voters N] [--producers N] [--blocks N] [--single-producer] [--contracts DIR] [--verbose]
+ */
+#include "native_chain.hpp"
+
+#include <fsciolib/asset.hpp>
+#include <fsciolib/datastream.hpp>
+#include <fsciolib/name.hpp>
+#include <fsciolib/symbol.hpp>
+#include <fsciolib/varint.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace fscio;
+
+#ifndef NATIVE_CONTRACTS_DIR
+#define NATIVE_CONTRACTS_DIR "."
+#endif
+
+namespace {
+
+   const symbol core_sym{ "FSC", 4 };
+   const int64_t unit = 10000;
+
+   /// wire format of public_key, so the driver does not depend on how the CDT models keys
+   struct packed_public_key {
+      unsigned_int           type;
+      std::array<char,33>    data;
+
+      FSCLIB_SERIALIZE( packed_public_key, (type)(data) )
+   };
+
+   struct options {
+      uint32_t     voters    = 1000;
+      uint32_t     producers = 21;
+      uint32_t     blocks    = 10000;
+      std::string  contracts = NATIVE_CONTRACTS_DIR;
+      bool         single_producer = false; ///< every voter votes for the first producer
+      bool         verbose   = false;
+   };
+
+   options parse_options( int argc, char** argv ) {
+      options o;
+      for( int i = 1; i < argc; ++i ) {
+         std::string arg = argv[i];
+         auto value = [&]() -> const char* {
+            if( i + 1 >= argc ) {
+               fprintf( stderr, "missing value for %s\n", arg.c_str() );
+               exit( 1 );
+            }
+            return argv[++i];
+         };
+         if( arg == "--voters" ) o.voters = uint32_t(strtoul( value(), nullptr, 10 ));
+         else if( arg == "--producers" ) o.producers = uint32_t(strtoul( value(), nullptr, 10 ));
+         else if( arg == "--blocks" ) o.blocks = uint32_t(strtoul( value(), nullptr, 10 ));
+         else if( arg == "--contracts" ) o.contracts = value();
+         else if( arg == "--single-producer" ) o.single_producer = true;
+         else if( arg == "--verbose" ) o.verbose = true;
+         else {
+            fprintf( stderr, "usage: %s [--voters N] [--producers N] [--blocks N] [--single-producer] [--contracts DIR] [--verbose]\n", argv[0] );
+            exit( 1 );
+         }
+      }
+      return o;
+   }
+
+   /// deterministic account names: prefix followed by the index in base 31 over [a-z1-5]
+   name make_name( const char* prefix, uint32_t index ) {
+      static const char* charmap = "abcdefghijklmnopqrstuvwxyz12345";
+      std::string str = prefix;
+      std::string suffix;
+      do {
+         suffix.insert( suffix.begin(), charmap[index % 31] );
+         index /= 31;
+      } while( index );
+      str += suffix;
+      return name( std::string_view( str ) );
+   }
+
+   template<typename... Args>
+   std::vector<char> args( const Args&... a ) {
+      return pack( std::make_tuple( a... ) );
+   }
+
+   /// half second slots since 2000-01-01, as block_timestamp counts them
+   uint32_t slot_of( uint64_t now ) {
+      return uint32_t( ( now / 1000 - 946684800000ull ) / 500 );
+   }
+
+   class bench {
+      public:
+         explicit bench( const options& o ) : _opts(o), _chain( fscio_native::current_chain() ) {
+            _chain.print_enabled = o.verbose;
+            _chain.set_now( 1546300800ull * 1000000 ); // 2019-01-01
+         }
+
+         void push( name account, name action, name actor, std::vector<char> data ) {
+            std::string error;
+            if( !_chain.push_action( account.value, action.value, actor.value, std::move(data), &error ) ) {
+               fprintf( stderr, "%s::%s by %s failed: %s\n", account.to_string().c_str(), action.to_string().c_str(),
+                        actor.to_string().c_str(), error.c_str() );
+               exit( 1 );
+            }
+         }
+
+         void setup() {
+            _chain.load_contract( "fscio"_n.value, _opts.contracts + "/fscio.system.native.so" );
+            _chain.load_contract( "fscio.token"_n.value, _opts.contracts + "/fscio.token.native.so" );
+            _chain.load_contract( "fscio.msig"_n.value, _opts.contracts + "/fscio.msig.native.so" );
+            for( auto n : { "fscio.ram"_n, "fscio.ramfee"_n, "fscio.stake"_n, "fscio.bpay"_n, "fscio.vpay"_n,
+                            "fscio.names"_n, "fscio.saving"_n, "fscio.resad"_n } ) {
+               _chain.create_account( n.value );
+            }
+
+            push( "fscio.token"_n, "create"_n, "fscio.token"_n, args( "fscio"_n, asset( 10'000'000'000ll * unit, core_sym ) ) );
+            push( "fscio.token"_n, "issue"_n, "fscio"_n, args( "fscio"_n, asset( 1'000'000'000ll * unit, core_sym ), std::string("init") ) );
+            push( "fscio"_n, "init"_n, "fscio"_n, args( unsigned_int(0), core_sym ) );
+            /// revision 2 turns on the caches kept in the repurposed global state slots
+            push( "fscio"_n, "updtrevision"_n, "fscio"_n, args( uint8_t(1) ) );
+            push( "fscio"_n, "updtrevision"_n, "fscio"_n, args( uint8_t(2) ) );
+
+            for( uint32_t i = 0; i < _opts.producers; ++i ) {
+               auto prod = make_name( "producer", i );
+               _producers.push_back( prod );
+               _chain.create_account( prod.value );
+               packed_public_key key{ unsigned_int(0), {} };
+               key.data[0] = 2;
+               key.data[1] = char(i + 1);
+               push( "fscio"_n, "regproducer"_n, prod, args( prod, key, std::string("https://example.com"), uint16_t(0), 0.5 ) );
+            }
+
+            /// enough stake in total to cross the activation threshold
+            _stake = std::max<int64_t>( 100, 7'000'000 / std::max<uint32_t>( _opts.voters, 1 ) + 100 ) * unit;
+            for( uint32_t i = 0; i < _opts.voters; ++i ) {
+               auto voter = make_name( "voter", i );
+               _voters.push_back( voter );
+               _chain.create_account( voter.value );
+               push( "fscio.token"_n, "transfer"_n, "fscio"_n,
+                     args( "fscio"_n, voter, asset( _stake + 1000 * unit, core_sym ), std::string("") ) );
+               push( "fscio"_n, "delegatebw"_n, voter,
+                     args( voter, voter, asset( _stake / 2, core_sym ), asset( _stake / 2, core_sym ), false ) );
+            }
+         }
+
+         void time( const char* label, uint32_t count, const std::function<void(uint32_t)>& op ) {
+            auto start = std::chrono::steady_clock::now();
+            for( uint32_t i = 0; i < count; ++i ) op( i );
+            auto elapsed = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+            printf( "%-14s %10u ops %12.3f ms %12.0f ops/sec %10.2f us/op\n", label, count, elapsed * 1000,
+                    elapsed > 0 ? count / elapsed : 0.0, count ? elapsed * 1e6 / count : 0.0 );
+         }
+
+         name voted_producer( uint32_t voter_index )const {
+            return _opts.single_producer ? _producers.front() : _producers[voter_index % _producers.size()];
+         }
+
+         void run() {
+            printf( "voters=%u producers=%u blocks=%u single_producer=%d\n", _opts.voters, _opts.producers, _opts.blocks,
+                    int(_opts.single_producer) );
+            if( _producers.empty() || _voters.empty() ) return;
+
+            time( "voteproducer", uint32_t(_voters.size()), [&]( uint32_t i ) {
+               push( "fscio"_n, "voteproducer"_n, _voters[i],
+                     args( _voters[i], voted_producer( i ), asset( _stake - _stake % unit - unit, core_sym ) ) );
+            });
+
+            time( "onblock", _opts.blocks, [&]( uint32_t i ) {
+               _chain.advance( 500000 );
+               push( "fscio"_n, "onblock"_n, "fscio"_n, args( slot_of( _chain.now() ), _producers[i % _producers.size()] ) );
+            });
+
+            _chain.advance( 2 * 24 * 3600 * 1000000ull );
+            time( "claimprod", uint32_t(_producers.size()), [&]( uint32_t i ) {
+               push( "fscio"_n, "claimprod"_n, _producers[i], args( _producers[i] ) );
+            });
+
+            time( "claimvoter", uint32_t(_voters.size()), [&]( uint32_t i ) {
+               push( "fscio"_n, "claimvoter"_n, _voters[i], args( _voters[i], voted_producer( i ) ) );
+            });
+
+            _chain.advance( 24 * 3600 * 1000000ull );
+            time( "claimall", uint32_t(_voters.size()), [&]( uint32_t i ) {
+               push( "fscio"_n, "claimall"_n, _voters[i], args( _voters[i] ) );
+            });
+
+            time( "delegatebw", uint32_t(_voters.size()), [&]( uint32_t i ) {
+               push( "fscio"_n, "delegatebw"_n, _voters[i],
+                     args( _voters[i], _voters[i], asset( unit, core_sym ), asset( unit, core_sym ), false ) );
+            });
+
+            time( "buyramkbytes", uint32_t(_voters.size()), [&]( uint32_t i ) {
+               push( "fscio"_n, "buyramkbytes"_n, _voters[i], args( _voters[i], _voters[i], uint32_t(1) ) );
+            });
+
+            time( "unregprod", uint32_t(_producers.size()), [&]( uint32_t i ) {
+               push( "fscio"_n, "unregprod"_n, _producers[i], args( _producers[i] ) );
+            });
+
+            printf( "rows=%zu proposed_schedules=%llu deferred=%llu\n", _chain.db().row_count(),
+                    (unsigned long long)_chain.schedule_count(), (unsigned long long)_chain.deferred_count() );
+         }
+
+      private:
+         options                 _opts;
+         fscio_native::chain&    _chain;
+         std::vector<name>       _producers;
+         std::vector<name>       _voters;
+         int64_t                 _stake = 0;
+   };
+
+} /// namespace
+
+int main( int argc, char** argv ) {
+   auto opts = parse_options( argc, argv );
+   try {
+      bench b( opts );
+      b.setup();
+      b.run();
+   } catch( const std::exception& e ) {
+      fprintf( stderr, "%s\n", e.what() );
+      return 1;
+   }
+   return 0;
+}
@@ -6,8 +6,12 @@
 namespace fscio {
 
 time_point current_time_point() {
+#ifdef FSCIO_NATIVE
+   return time_point{ microseconds{ static_cast<int64_t>( current_time() ) } };
+#else
    const static time_point ct{ microseconds{ static_cast<int64_t>( current_time() ) } };
    return ct;
+#endif
 }
 
 void multisig::propose( ignore<name> proposer,
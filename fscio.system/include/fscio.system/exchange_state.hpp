@@ -12,6 +12,9 @@ namespace fsciosystem {
     *  Uses Bancor math to create a 50/50 relay between two asset types. The state of the
     *  bancor exchange is entirely contained within this struct. There are no external
     *  side effects associated with using this API.
+    *
+    *  Connectors with the default weight of 0.5 are converted with integer math only and always
+    *  round in favour of the market; other weights fall back to the floating point formulas.
     */
    struct [[fscio::table, fscio::contract("fscio.system")]] exchange_state {
       asset    supply;
@@ -30,8 +33,12 @@ namespace fsciosystem {
 
       asset convert_to_exchange( connector& c, asset in );
       asset convert_from_exchange( connector& c, asset in );
+      asset convert_direct( connector& from, connector& to, asset in );
       asset convert( asset from, const symbol& to );
 
+      /// smallest amount of from_symbol that convert() turns into at least out
+      asset required_input( const asset& out, const symbol& from_symbol )const;
+
       FSCLIB_SERIALIZE( exchange_state, (supply)(base)(quote) )
    };
 
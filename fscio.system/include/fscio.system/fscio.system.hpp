@@ -14,6 +14,8 @@
 #include <string>
 #include <type_traits>
 #include <optional>
+#include <memory>
+#include <map>
 
 namespace fsciosystem {
 
@@ -47,6 +49,15 @@ namespace fsciosystem {
          return ( flags & ~static_cast<F>(field) );
    }
 
+   /// one receiver of delegatebwmany or undelegatebwmany
+   struct bw_delegation {
+      name            receiver;
+      asset           net_quantity;
+      asset           cpu_quantity;
+
+      FSCLIB_SERIALIZE( bw_delegation, (receiver)(net_quantity)(cpu_quantity) )
+   };
+
    struct [[fscio::table, fscio::contract("fscio.system")]] name_bid {
      name            newname;
      name            high_bidder;
@@ -96,11 +107,11 @@ namespace fsciosystem {
       double               total_producer_vote_weight = 0; /// the sum of all producer votes
       block_timestamp      last_name_close;
       uint16_t             new_ram_per_block = 0;
-      block_timestamp      last_ram_increase;
+      block_timestamp      last_ram_increase; ///< rammarket and max_ram_size exclude the new_ram_per_block growth after this
       block_timestamp      last_block_num; /* deprecated */
       double               total_producer_votepay_share = 0;
       double               total_producer_blockpay_share = 0;
-      uint8_t              revision = 0; ///< used to track version updates in the future.
+      uint8_t              revision = 0; ///< used to track version updates in the future, 2 clears reserved4..reserved8 for the fields below
       time_point           last_vpay_state_update;
       double               total_vpay_share_change_rate = 0;
       time_point           last_bpay_state_update;
@@ -112,11 +123,11 @@ namespace fsciosystem {
       time_point           reserved1;
       time_point           reserved2;
       time_point           reserved3;
-      uint64_t             reserved4;
-      uint64_t             reserved5;
-      uint64_t             reserved6;
-      uint64_t             reserved7;
-      uint64_t             reserved8;
+      uint64_t             vote_weight_week = 0;       ///< week of vote_weight_multiplier, replaces reserved4
+      double               vote_weight_multiplier = 0; ///< cached stake2vote multiplier, replaces reserved5
+      uint64_t             last_proposed_schedule_hash = 0; ///< truncated sha256 of the last proposed schedule, replaces reserved6
+      uint64_t             res_airdrop_migrated = 0;       ///< set once the resad table is folded into userres, replaces reserved7
+      uint64_t             ram_batch_mode = 0;             ///< queue buyram/sellram for onblock, replaces reserved8
       uint64_t             reserved9;
 
       // explicit serialization macro is not necessary, used here only to improve compilation time
@@ -128,18 +139,18 @@ namespace fsciosystem {
                                 (last_ram_increase)(last_block_num)(total_producer_votepay_share)(total_producer_blockpay_share)(revision) 
                                 (last_vpay_state_update)(total_vpay_share_change_rate)(last_bpay_state_update)(total_bpay_share_change_rate)
                                 (res_airdrop_limit_net)(res_airdrop_limit_cpu)(res_airdrop_limit_ram_bytes)
-                                (reserved1)(reserved2)(reserved3)(reserved4)(reserved5)(reserved6)(reserved7)(reserved8)(reserved8)
+                                (reserved1)(reserved2)(reserved3)(vote_weight_week)(vote_weight_multiplier)(last_proposed_schedule_hash)(res_airdrop_migrated)(ram_batch_mode)(reserved9)
                               )
    };
 
    struct [[fscio::table, fscio::contract("fscio.system")]] producer_info {
       name                  owner;
-      std::vector<name>     voters;
+      std::vector<name>     voters; ///< deprecated, accounts that voted before prodvoters existed, no longer written
       double                total_votes = 0;
       fscio::public_key     producer_key; /// a packed public key object
       bool                  is_active = true;
       std::string           url;
-      uint32_t              unpaid_blocks = 0;
+      uint32_t              unpaid_blocks = 0; ///< deprecated, blocks counted before prodstats existed, paid out and zeroed on the next distribution
       time_point            last_claim_time;
       uint16_t              location = 0;
       double                votepay_share = 0;
@@ -148,8 +159,8 @@ namespace fsciosystem {
       time_point            last_blockpay_share_update;
       double                commission_rate = 0;
       time_point            last_commission_rate_adjustment_time;
-      int128_t              total_voteage;
-      fscio::asset          total_vote_num;
+      int128_t              total_voteage; /// sum of the voteage of all votes as of voteage_update_time
+      fscio::asset          total_vote_num; /// sum of all votes, the rate at which total_voteage grows
       time_point            voteage_update_time;
       int64_t               rewards_producer_block_pay_balance = 0;
       int64_t               rewards_producer_vote_pay_balance = 0;
@@ -179,16 +190,29 @@ namespace fsciosystem {
                       )
    };
 
+   /**
+    *  Per-block counters of a producer. They are kept apart from producer_info so that onblock only
+    *  rewrites this small row, and are folded into the producer's rewards by distribute_voters_rewards.
+    */
+   struct [[fscio::table, fscio::contract("fscio.system")]] producer_stats {
+      name                  owner;
+      uint32_t              unpaid_blocks = 0;
+      block_timestamp       last_block_time; /// the last block produced by owner
+
+      uint64_t primary_key()const { return owner.value; }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      FSCLIB_SERIALIZE( producer_stats, (owner)(unpaid_blocks)(last_block_time) )
+   };
+
    struct [[fscio::table, fscio::contract("fscio.system")]] voter_info {
       name                 owner;     /// the voter
       fscio::asset         staked_balance;
       /**
-       *  Every time a vote is cast we must first "undo" the last vote weight, before casting the
-       *  new vote weight.  Vote weight is calculated as:
-       *
-       *  stated.amount * 2 ^ ( weeks_since_launch/weeks_per_year)
+       *  Unused. Every vote_info row keeps the weight of its own vote, which is what gets undone
+       *  when that vote changes; the field is kept for the row layout.
        */
-      double              last_vote_weight = 0; /// the vote weight cast the last time the vote was updated
+      double              last_vote_weight = 0;
 
       time_point           last_claim_time;
       uint32_t             flags1 = 0;
@@ -231,6 +255,23 @@ namespace fsciosystem {
                       )
    };
 
+   /**
+    *  Every producer has a scope/table listing the accounts that currently vote for it, so the producer
+    *  row keeps a fixed size no matter how many voters it has. The votes of a voter are found the
+    *  other way round in the voter's scope of the votes table.
+    */
+   struct [[fscio::table, fscio::contract("fscio.system")]] producer_voter {
+      name                 voter;
+
+      time_point           reserved1;
+      uint64_t             reserved2;
+
+      uint64_t             primary_key() const { return voter.value; }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      FSCLIB_SERIALIZE( producer_voter, (voter)(reserved1)(reserved2) )
+   };
+
    struct [[fscio::table, fscio::contract("fscio.system")]] res_airdrop_info {
       name                owner;            /// the accept airdrop user
       fscio::asset        res_airdrop_net;  /// airdropped net
@@ -249,16 +290,58 @@ namespace fsciosystem {
                       )  
    };
 
+   /// retired: the airdrop amounts now live on the userres row, rows left here are moved by migrateresad
    typedef fscio::multi_index<"resad"_n, res_airdrop_info> res_airdrop_table; 
 
+   /**
+    *  A buyram or sellram queued while the ram market runs in batch mode. Buy orders are paid and
+    *  sell orders have their bytes locked when they are placed; onblock fills all of them at one price.
+    */
+   struct [[fscio::table, fscio::contract("fscio.system")]] ram_order {
+      uint64_t            id;
+      name                owner;            /// payer of a buy, seller of a sell
+      name                receiver;         /// receiver of the bytes of a buy
+      fscio::asset        quant;            /// core paid into the market by a buy, after the fee
+      int64_t             bytes = 0;        /// bytes offered by a sell
+
+      uint64_t primary_key()const { return id; }
+      bool     is_buy()const      { return bytes == 0; }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      FSCLIB_SERIALIZE( ram_order, (id)(owner)(receiver)(quant)(bytes) )
+   };
+
+   typedef fscio::multi_index< "ramorders"_n, ram_order >  ram_orders_table;
+
+   /**
+    *  Core token owed to a seller whose queued sellram orders onblock has filled, or to a buyer whose
+    *  queued buyram order would have received no bytes, collected with claimramsale together with the
+    *  fee owed to fscio.ramfee.
+    */
+   struct [[fscio::table, fscio::contract("fscio.system")]] ram_proceeds {
+      name                owner;
+      fscio::asset        balance;          /// owed to owner, after the fee
+      fscio::asset        fee;              /// owed to fscio.ramfee for the same fills
+
+      uint64_t primary_key()const { return owner.value; }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      FSCLIB_SERIALIZE( ram_proceeds, (owner)(balance)(fee) )
+   };
+
+   typedef fscio::multi_index< "ramproceeds"_n, ram_proceeds >  ram_proceeds_table;
+
    typedef fscio::multi_index< "voters"_n, voter_info >  voters_table;
    typedef fscio::multi_index< "votes"_n, vote_info >  votes_table;
+   typedef fscio::multi_index< "prodvoters"_n, producer_voter >  producer_voters_table;
 
 
    typedef fscio::multi_index< "producers"_n, producer_info,
                                indexed_by<"prototalvote"_n, const_mem_fun<producer_info, double, &producer_info::by_votes>  >
                              > producers_table;
 
+   typedef fscio::multi_index< "prodstats"_n, producer_stats >  producer_stats_table;
+
    typedef fscio::singleton< "global"_n, fscio_global_state >   global_state_singleton;
 
    //   static constexpr uint32_t     max_inflation_rate = 5;  // 5% annual inflation
@@ -268,10 +351,16 @@ namespace fsciosystem {
       private:
          voters_table            _voters;
          producers_table         _producers;
+         producer_stats_table    _prodstats;
          global_state_singleton  _global;
          fscio_global_state      _gstate;
+         std::vector<char>       _gstate_packed; ///< _gstate as loaded, empty before the first write
          rammarket               _rammarket;
 
+         /// userres, delband and refunds tables opened by this action, one instance per scope
+         struct scoped_tables;
+         std::unique_ptr<scoped_tables> _tables;
+
       public:
          static constexpr fscio::name active_permission{"active"_n};
          static constexpr fscio::name token_account{"fscio.token"_n};
@@ -333,10 +422,10 @@ namespace fsciosystem {
           *  This will cause an immediate reduction in net/cpu bandwidth of the
           *  receiver.
           *
-          *  A transaction is scheduled to send the tokens back to 'from' after
-          *  the staking period has passed. If existing transaction is scheduled, it
-          *  will be canceled and a new transaction issued that has the combined
-          *  undelegated amount.
+          *  The tokens are added to the refund request of 'from', which is queued by
+          *  request time. Once the staking period has passed 'from' collects the
+          *  combined undelegated amount with the refund action; undelegating again
+          *  before that restarts the period for the whole request.
           *
           *  The 'from' account loses voting power as a result of this call and
           *  all producer tallies are updated.
@@ -345,6 +434,34 @@ namespace fsciosystem {
          void undelegatebw( name from, name receiver,
                             asset unstake_net_quantity, asset unstake_cpu_quantity );
 
+         /**
+          *  delegatebw for many receivers at once. The stake is moved with one transfer and, without the
+          *  transfer flag, the voting power of 'from' is updated once for the whole list.
+          */
+         [[fscio::action]]
+         void delegatebwmany( name from, const std::vector<bw_delegation>& delegations, bool transfer );
+
+         /**
+          *  undelegatebw for many receivers at once. All unstaked tokens go into a single refund request
+          *  and the voting power of 'from' is updated once.
+          */
+         [[fscio::action]]
+         void undelegatebwmany( name from, const std::vector<bw_delegation>& delegations );
+
+         /**
+          *  Prints the accounts that delegated bandwidth to receiver, at most limit of them starting
+          *  at lower_bound, without changing any state. The list is incomplete until syncdelband has
+          *  copied the delegations made before the delbandto index existed.
+          */
+         [[fscio::action]]
+         void getdelband( name receiver, name lower_bound, uint32_t limit );
+
+         /**
+          *  Backfills delbandto from delband for the given (from, to) pairs. Safe to repeat.
+          */
+         [[fscio::action]]
+         void syncdelband( const std::vector<std::pair<name, name>>& delegations );
+
 
          /**
           * Increases receiver's ram quota based upon current price and quantity of
@@ -354,6 +471,19 @@ namespace fsciosystem {
          [[fscio::action]]
          void buyramkbytes( name payer, name receiver, uint32_t kbytes );
 
+         /**
+          * Same as buyramkbytes, but fails without transferring anything if the ram costs more than max_cost.
+          */
+         [[fscio::action]]
+         void buyramlimit( name payer, name receiver, uint32_t kbytes, asset max_cost );
+
+         /**
+          * Buys ram for several receivers at once. The market is updated once for the combined quantity,
+          * the payer is charged with a single transfer plus fee and the bytes are split pro rata.
+          */
+         [[fscio::action]]
+         void buyrambatch( name payer, const std::vector<std::pair<name, asset>>& receivers );
+
          /**
           *  Reduces quota my kbytes and then performs an inline transfer of tokens
           *  to receiver based upon the average purchase price of the original quota.
@@ -361,6 +491,20 @@ namespace fsciosystem {
          [[fscio::action]]
          void sellram( name account, int64_t kbytes );
 
+         /**
+          * Same as sellram, but fails without transferring anything if the tokens received after the fee
+          * are less than min_out.
+          */
+         [[fscio::action]]
+         void sellramlimit( name account, int64_t kbytes, asset min_out );
+
+         /**
+          * Prints the current cost of quantity bytes, or the bytes bought by quantity core token, without
+          * changing the ram market.
+          */
+         [[fscio::action]]
+         void quoteram( asset quantity );
+
          /**
           *  This action is called after the delegation-period to claim all pending
           *  unstaked tokens belonging to owner
@@ -368,6 +512,13 @@ namespace fsciosystem {
          [[fscio::action]]
          void refund( name owner );
 
+         /**
+          *  Pays out the matured refunds of the given owners, skipping any that have none. Anyone may
+          *  call it, the owners are read from the bytime index of the refundq table.
+          */
+         [[fscio::action]]
+         void processrefunds( const std::vector<name>& owners );
+
          // functions defined in voting.cpp
 
          [[fscio::action]]
@@ -385,6 +536,20 @@ namespace fsciosystem {
          [[fscio::action]]
          void voteproducer( const name voter_name, const name producer_name, const asset vote_num );
 
+         /**
+          *  Same as voteproducer for several producers in one action. Producers must be listed once
+          *  each and sorted by name.
+          */
+         [[fscio::action]]
+         void voteproducers( const name voter_name, const std::vector<std::pair<name, asset>>& votes );
+
+         /**
+          *  Recomputes total_votes of producer from the votes cast for it. Run once per producer after
+          *  upgrading from the release that subtracted the voter's last vote weight instead.
+          */
+         [[fscio::action]]
+         void recountvotes( const name producer );
+
          [[fscio::action]]
          void setparams( const fscio::blockchain_parameters& params );
 
@@ -395,6 +560,13 @@ namespace fsciosystem {
          [[fscio::action]]
          void claimvoter( const name owner, const name producer );
 
+         /**
+          *  Claims the voter rewards of owner from every producer it votes for, paid out with at most
+          *  one vote pay and one block pay transfer.
+          */
+         [[fscio::action]]
+         void claimall( const name owner );
+
          [[fscio::action]]
          void setpriv( name account, uint8_t is_priv );
 
@@ -419,6 +591,34 @@ namespace fsciosystem {
          [[fscio::action]]
          void setresadcfg( uint32_t limit_ram_bytes, asset limit_net, asset limit_cpu );
 
+         /**
+          * Airdrops ram_bytes of ram plus net and cpu stake to every receiver in one pass,
+          * with a single market update and a single stake transfer for the whole batch.
+          */
+         [[fscio::action]]
+         void airdropres( const std::vector<name>& receivers, uint32_t ram_bytes, asset net, asset cpu );
+
+         /**
+          * Moves up to max_rows rows of the retired resad table onto the userres rows of their owners.
+          */
+         [[fscio::action]]
+         void migrateresad( uint32_t max_rows );
+
+         /**
+          * Switches the ram market between filling every buyram/sellram immediately and queueing them
+          * to be filled at one price at the start of the next block. While orders are batched only buyram
+          * and sellram are accepted: buyramkbytes, buyramlimit, sellramlimit, buyrambatch and ram airdrops
+          * would fill ahead of the queue.
+          */
+         [[fscio::action]]
+         void setrambatch( bool enabled );
+
+         /**
+          * Transfers the tokens of the owner's sellram orders that were filled in batch mode.
+          */
+         [[fscio::action]]
+         void claimramsale( name owner );
+
       private:
       
          // Functional control variable    
@@ -430,6 +630,9 @@ namespace fsciosystem {
          static constexpr uint64_t claim_prod_rewards_preiod        = 1 * one_day_time;                         // 1days
          static constexpr uint64_t voteage_basis                    = claim_prod_rewards_preiod / 1000000ll;    // claim rewards preiod 's one fifth
          static constexpr uint64_t top_producers_size               = 15;                                       // FSC default 15
+         static constexpr uint64_t max_producers_per_vote           = 30;                                       // voteproducers list limit
+         static constexpr uint32_t max_ram_orders_per_block         = 200;                                      // ram orders filled per onblock
+         static constexpr uint32_t max_refunds_per_action           = 100;                                      // processrefunds list limit
          // Implementation details:
 
          static symbol get_core_symbol( const rammarket& rm ) {
@@ -444,16 +647,38 @@ namespace fsciosystem {
          static block_timestamp current_block_time();
 
          symbol core_symbol()const;
+         bool global_slots_cleared()const;
+         bool ram_orders_batched()const;
 
          void update_ram_supply();
+         int64_t pending_ram_growth()const;
+         exchange_state current_ram_market()const;
+         void set_ram_market( const exchange_state& market );
 
          //defined in delegate_bandwidth.cpp
+         scoped_tables& tables();
          void buyram( name payer, name receiver, asset quant );
+         void add_ram( name receiver, int64_t bytes_out );
+         asset ram_price_with_fee( int64_t bytes )const;
+         void check_airdrop_limits( const asset& net, const asset& cpu );
+         void update_delband( name from, name receiver, const asset& stake_net_delta, const asset& stake_cpu_delta );
+         void update_stake_totals( name from, name receiver, const asset& stake_net_delta, const asset& stake_cpu_delta );
+         void enqueue_refund( name owner, fscio::time_point_sec request_time );
+         void dequeue_refund( name owner );
+         asset update_refund( name from, name receiver, const asset& stake_net_delta, const asset& stake_cpu_delta, bool transfer );
+         void update_voter_stake( name from, const asset& total_update );
+         res_airdrop_table::const_iterator fold_legacy_airdrop( res_airdrop_table& airdrop, res_airdrop_table::const_iterator itr );
+         void fold_legacy_airdrop( name owner );
+         void fill_ram_orders();
+         void credit_ram_proceeds( name owner, int64_t amount, int64_t fee );
          void changebw( name from, name receiver,
                         asset stake_net_quantity, asset stake_cpu_quantity, bool transfer );
+         void changebw_many( name from, const std::vector<bw_delegation>& delegations, bool undelegate, bool transfer );
 
          //defined in voting.hpp
          void update_elected_producers( block_timestamp timestamp );
+         void update_votes( const name voter_name, const std::vector<std::pair<name, asset>>& votes );
+         double stake2vote( int64_t staked );
 
          // defined in voting.cpp
          double update_producer_votepay_share( const producers_table::const_iterator& prod_itr,
@@ -461,12 +686,16 @@ namespace fsciosystem {
                                                double shares_rate, bool reset_to_zero = false );
          double update_total_votepay_share( time_point ct,
                                             double additional_shares_delta = 0.0, double shares_rate_delta = 0.0 );
-         int128_t calculate_prod_all_voter_age( const name producer, const time_point distribut_time );
+         int128_t calculate_voteage( int128_t voteage, int64_t vote_amount, time_point last_update, time_point ct );
+         int128_t calculate_prod_all_voter_age( const producer_info& prod, const time_point distribut_time );
 
          // defined in producer_pay.cpp
          uint64_t precision_unit_integer( void );
          uint64_t get_min_activated_stake( void );
          void distribute_voters_rewards( const time_point distribut_time, const name producer );
+         bool settle_voter_rewards( votes_table& votes_tbl, const vote_info& vts, const producer_info& prod,
+                                    const time_point ct, int64_t& vote_reward, int64_t& block_reward );
+         void pay_voter_rewards( const name owner, int64_t vote_reward, int64_t block_reward );
          void require_activated();
    };
 
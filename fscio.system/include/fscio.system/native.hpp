@@ -12,6 +12,8 @@
 #include <fsciolib/contract.hpp>
 #include <fsciolib/ignore.hpp>
 
+#include <map>
+
 namespace fsciosystem {
    using fscio::name;
    using fscio::permission_level;
@@ -80,6 +82,18 @@ namespace fsciosystem {
     * Method parameters commented out to prevent generation of code that parses input data.
     */
    class [[fscio::contract("fscio.system")]] native : public fscio::contract {
+      protected:
+         /// resource limits changed by this action, set by the system_contract destructor
+         struct account_limits {
+            int64_t ram_bytes;
+            int64_t net_weight;
+            int64_t cpu_weight;
+         };
+         std::map<uint64_t, account_limits> _pending_limits;
+
+         void get_account_limits( name account, int64_t* ram_bytes, int64_t* net_weight, int64_t* cpu_weight );
+         void set_account_limits( name account, int64_t ram_bytes, int64_t net_weight, int64_t cpu_weight );
+
       public:
 
          using fscio::contract::contract;
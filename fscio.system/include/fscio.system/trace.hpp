@@ -0,0 +1,42 @@
+/**
+ *  @file
+ *  @copyright defined in fsc/LICENSE.txt
+ */
+#pragma once
+
+#include <fsciolib/print.hpp>
+
+/**
+ *  Compile-time tracing of the system contract hot paths.
+ *
+ *  Nothing is traced unless FSCIO_SYSTEM_TRACE is defined (the FSCIO_SYSTEM_TRACE option of the
+ *  fscio.system target), in which case every subsystem is traced unless its own switch
+ *  (FSCIO_SYSTEM_TRACE_VOTING, FSCIO_SYSTEM_TRACE_PAY, FSCIO_SYSTEM_TRACE_RAM) is defined to 0.
+ *  A disabled trace expands to nothing and its arguments are never evaluated.
+ *
+ *  Each trace prints a single line prefixed with the subsystem: "[pay] distribute producer=... ".
+ */
+#ifdef FSCIO_SYSTEM_TRACE
+
+   #ifndef FSCIO_SYSTEM_TRACE_VOTING
+      #define FSCIO_SYSTEM_TRACE_VOTING 1
+   #endif
+   #ifndef FSCIO_SYSTEM_TRACE_PAY
+      #define FSCIO_SYSTEM_TRACE_PAY 1
+   #endif
+   #ifndef FSCIO_SYSTEM_TRACE_RAM
+      #define FSCIO_SYSTEM_TRACE_RAM 1
+   #endif
+
+   #define FSCIO_SYSTEM_TRACE_IF( enabled, subsystem, ... ) \
+      do { if( enabled ) { ::fscio::print( "[" subsystem "] ", __VA_ARGS__, "\n" ); } } while( false )
+
+#else
+
+   #define FSCIO_SYSTEM_TRACE_IF( enabled, subsystem, ... ) do {} while( false )
+
+#endif
+
+#define FSCIO_TRACE_VOTING( ... ) FSCIO_SYSTEM_TRACE_IF( FSCIO_SYSTEM_TRACE_VOTING, "voting", __VA_ARGS__ )
+#define FSCIO_TRACE_PAY( ... )    FSCIO_SYSTEM_TRACE_IF( FSCIO_SYSTEM_TRACE_PAY,    "pay",    __VA_ARGS__ )
+#define FSCIO_TRACE_RAM( ... )    FSCIO_SYSTEM_TRACE_IF( FSCIO_SYSTEM_TRACE_RAM,    "ram",    __VA_ARGS__ )
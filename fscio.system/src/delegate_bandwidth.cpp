@@ -3,6 +3,7 @@
  *  @copyright defined in fsc/LICENSE.txt
  */
 #include <fscio.system/fscio.system.hpp>
+#include <fscio.system/trace.hpp>
 
 #include <fsciolib/fscio.hpp>
 #include <fsciolib/print.hpp>
@@ -15,6 +16,7 @@
 #include <fscio.token/fscio.token.hpp>
 
 
+#include <algorithm>
 #include <cmath>
 #include <map>
 
@@ -37,10 +39,16 @@ namespace fsciosystem {
       asset         cpu_weight;
       int64_t       ram_bytes = 0;
 
+      /// resources airdropped by fscio.resad, only present on the accounts it created
+      fscio::binary_extension<asset>     airdrop_net;
+      fscio::binary_extension<asset>     airdrop_cpu;
+      fscio::binary_extension<uint32_t>  airdrop_ram;
+
       uint64_t primary_key()const { return owner.value; }
+      bool     is_airdrop_account()const { return airdrop_ram.has_value(); }
 
       // explicit serialization macro is not necessary, used here only to improve compilation time
-      FSCLIB_SERIALIZE( user_resources, (owner)(net_weight)(cpu_weight)(ram_bytes) )
+      FSCLIB_SERIALIZE( user_resources, (owner)(net_weight)(cpu_weight)(ram_bytes)(airdrop_net)(airdrop_cpu)(airdrop_ram) )
    };
 
 
@@ -60,6 +68,22 @@ namespace fsciosystem {
 
    };
 
+   /**
+    *  The delband rows again, scoped by the receiver 'to' with the delegator 'from' as the primary key,
+    *  so the delegators of one account can be read without visiting every delband scope.
+    */
+   struct [[fscio::table, fscio::contract("fscio.system")]] delegated_bandwidth_by_to {
+      name          from;
+      name          to;
+      asset         net_weight;
+      asset         cpu_weight;
+
+      uint64_t  primary_key()const { return from.value; }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      FSCLIB_SERIALIZE( delegated_bandwidth_by_to, (from)(to)(net_weight)(cpu_weight) )
+   };
+
    struct [[fscio::table, fscio::contract("fscio.system")]] refund_request {
       name            owner;
       time_point_sec  request_time;
@@ -72,13 +96,65 @@ namespace fsciosystem {
       FSCLIB_SERIALIZE( refund_request, (owner)(request_time)(net_amount)(cpu_amount) )
    };
 
+   /**
+    *  One entry per pending refund request, kept in the scope of the system contract so that matured
+    *  refunds of all owners can be found in request order. The queue itself is never drained on chain: a
+    *  transfer to an owner can be rejected by the owner, so processrefunds pays only the owners it is
+    *  given, read from the bytime index by whoever calls it.
+    */
+   struct [[fscio::table, fscio::contract("fscio.system")]] refund_queue_entry {
+      name            owner;
+      time_point_sec  request_time;
+
+      uint64_t  primary_key()const     { return owner.value; }
+      uint64_t  by_request_time()const { return request_time.utc_seconds; }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      FSCLIB_SERIALIZE( refund_queue_entry, (owner)(request_time) )
+   };
+
    /**
     *  These tables are designed to be constructed in the scope of the relevant user, this
     *  facilitates simpler API for per-user queries
     */
    typedef fscio::multi_index< "userres"_n, user_resources >      user_resources_table;
    typedef fscio::multi_index< "delband"_n, delegated_bandwidth > del_bandwidth_table;
+   typedef fscio::multi_index< "delbandto"_n, delegated_bandwidth_by_to > delband_by_to_table;
    typedef fscio::multi_index< "refunds"_n, refund_request >      refunds_table;
+   typedef fscio::multi_index< "refundq"_n, refund_queue_entry,
+                               indexed_by<"bytime"_n, const_mem_fun<refund_queue_entry, uint64_t, &refund_queue_entry::by_request_time> >
+                             > refund_queue_table;
+
+   /**
+    *  multi_index keeps every row it has unpacked, so each scope is opened once per action and shared by
+    *  all helpers: a row is read once however many of them look at it, and a change made by one helper is
+    *  what the next one sees.
+    */
+   struct system_contract::scoped_tables {
+      name                                  self;
+      map<uint64_t, user_resources_table>   userres_by_scope;
+      map<uint64_t, del_bandwidth_table>    delband_by_scope;
+      map<uint64_t, delband_by_to_table>    delband_by_to_by_scope;
+      map<uint64_t, refunds_table>          refunds_by_scope;
+
+      user_resources_table& userres( name owner ) {
+         return userres_by_scope.try_emplace( owner.value, self, owner.value ).first->second;
+      }
+      del_bandwidth_table& delband( name from ) {
+         return delband_by_scope.try_emplace( from.value, self, from.value ).first->second;
+      }
+      delband_by_to_table& delband_by_to( name to ) {
+         return delband_by_to_by_scope.try_emplace( to.value, self, to.value ).first->second;
+      }
+      refunds_table& refunds( name owner ) {
+         return refunds_by_scope.try_emplace( owner.value, self, owner.value ).first->second;
+      }
+   };
+
+   system_contract::scoped_tables& system_contract::tables() {
+      if( !_tables ) _tables.reset( new scoped_tables{ _self } );
+      return *_tables;
+   }
 
 
 
@@ -86,14 +162,83 @@ namespace fsciosystem {
     *  This action will buy an exact amount of ram and bill the payer the current market price.
     */
    void system_contract::buyramkbytes( name payer, name receiver, uint32_t kbytes ) {
+      fscio_assert( !ram_orders_batched(), "exact amounts of ram are not available while ram orders are batched" );
+
+      uint64_t bytes = kbytes * 1024ull;
+
+      buyram( payer, receiver, ram_price_with_fee( bytes ) );
+   }
+
+   /**
+    *  Like buyramkbytes, but fails before anything is transferred when the ram costs more than max_cost.
+    */
+   void system_contract::buyramlimit( name payer, name receiver, uint32_t kbytes, asset max_cost ) {
+      require_auth( payer );
+      fscio_assert( !ram_orders_batched(), "price limits are not available while ram orders are batched" );
+      fscio_assert( max_cost.symbol == core_symbol(), "max cost must be in core token" );
 
       uint64_t bytes = kbytes * 1024ull;
+      auto cost = ram_price_with_fee( bytes );
+      fscio_assert( cost <= max_cost, "ram price exceeds max cost" );
+
+      buyram( payer, receiver, cost );
+   }
+
+   /**
+    *  Like sellram, but fails before anything is transferred when the seller would receive less than min_out
+    *  after the fee.
+    */
+   void system_contract::sellramlimit( name account, int64_t kbytes, asset min_out ) {
+      require_auth( account );
+      fscio_assert( !ram_orders_batched(), "price limits are not available while ram orders are batched" );
+      fscio_assert( min_out.symbol == core_symbol(), "min out must be in core token" );
+      fscio_assert( kbytes > 0, "cannot sell negative byte" );
 
-      auto itr = _rammarket.find(ramcore_symbol.raw());
-      auto tmp = *itr;
-      auto fscout = tmp.convert( asset(bytes, ram_symbol), core_symbol() );
+      auto market = current_ram_market();
+      auto tokens_out = market.convert( asset( kbytes * 1024ll, ram_symbol ), core_symbol() );
+      tokens_out.amount -= ( tokens_out.amount + 199 ) / 200; /// .5% fee (round up)
+      fscio_assert( tokens_out >= min_out, "ram sells for less than min out" );
 
-      buyram( payer, receiver, fscout );
+      sellram( account, kbytes );
+   }
+
+   /**
+    *  Prints what the ram market would do with quantity in this block: the core cost including the fee
+    *  when quantity is in bytes, or the bytes received after the fee when quantity is in core token.
+    *  Nothing is written, pending supply growth is applied to a copy of the market.
+    */
+   void system_contract::quoteram( asset quantity ) {
+      fscio_assert( quantity.amount > 0, "must quote a positive amount" );
+
+      if( quantity.symbol == ram_symbol ) {
+         print( ram_price_with_fee( quantity.amount ) );
+         return;
+      }
+
+      fscio_assert( quantity.symbol == core_symbol(), "must quote ram bytes or core token" );
+      auto quant_after_fee = quantity;
+      quant_after_fee.amount -= ( quant_after_fee.amount + 199 ) / 200; /// .5% fee (round up)
+      fscio_assert( quant_after_fee.amount > 0, "must quote a positive amount" );
+
+      auto market = current_ram_market();
+      print( market.convert( quant_after_fee, ram_symbol ) );
+   }
+
+   /**
+    *  Current price of an exact amount of ram including the .5% fee buyram takes off the top.
+    */
+   asset system_contract::ram_price_with_fee( int64_t bytes )const
+   {
+      const auto market = current_ram_market();
+      auto cost = market.required_input( asset(bytes, ram_symbol), core_symbol() );
+
+      /// the fee is rounded up the same way buyram does
+      auto quant = cost;
+      quant.amount += ( cost.amount + 198 ) / 199;
+      while( quant.amount - ( quant.amount + 199 ) / 200 < cost.amount ) {
+         ++quant.amount;
+      }
+      return quant;
    }
 
 
@@ -108,26 +253,26 @@ namespace fsciosystem {
    void system_contract::buyram( name payer, name receiver, asset quant )
    {
       require_auth( payer );
-      update_ram_supply();
 
       fscio_assert( quant.symbol == core_symbol(), "must buy ram with core token" );
       fscio_assert( quant.amount > 0, "must purchase a positive amount" );
 
       /// airdrop memory resources for user 
       if ( payer == resairdrop_account ) {
+         fscio_assert( !ram_orders_batched(), "ram cannot be airdropped while ram orders are batched" );
          fscio_assert( _gstate.res_airdrop_limit_ram_bytes > 0,  "The airdrop memory resource function has been turned off" );
          
-         res_airdrop_table  airdrop( _self, _self.value );
-         auto airdrop_itr = airdrop.find( receiver.value );
-         if( airdrop_itr != airdrop.end() ) {
-            fscio_assert( airdrop_itr->res_airdrop_ram == 0,  "memory resources can only be dropped once" ); 
-            const auto& itr = _rammarket.get( ramcore_symbol.raw(), "ram market does not exist" );
-            auto rambytes(itr);
+         fold_legacy_airdrop( receiver );
+         auto& userres = tables().userres( receiver );
+         auto res_itr = userres.find( receiver.value );
+         if( res_itr != userres.end() && res_itr->is_airdrop_account() ) {
+            fscio_assert( res_itr->airdrop_ram.value() == 0,  "memory resources can only be dropped once" ); 
+            auto rambytes = current_ram_market();
             auto airdrop_ram_bytes = rambytes.convert( quant, ram_symbol ).amount;
             fscio_assert( airdrop_ram_bytes <= _gstate.res_airdrop_limit_ram_bytes, "The airdrop memory exceeded the maximum limit" );
          
-            airdrop.modify( airdrop_itr, same_payer, [&]( auto& resad ) {
-               resad.res_airdrop_ram = static_cast<uint32_t>( airdrop_ram_bytes );
+            userres.modify( res_itr, same_payer, [&]( auto& res ) {
+               res.airdrop_ram.value() = static_cast<uint32_t>( airdrop_ram_bytes );
             });
 
          }else {
@@ -157,19 +302,100 @@ namespace fsciosystem {
          );
       }
 
+      /// an order that buys nothing at the current price is refused here, one that drops to nothing by
+      /// the time onblock fills it is refunded there
+      if( ram_orders_batched() ) {
+         fscio_assert( current_ram_market().convert( quant_after_fee, ram_symbol ).amount > 0, "must reserve a positive amount" );
+
+         ram_orders_table orders( _self, _self.value );
+         orders.emplace( payer, [&]( auto& o ) {
+            o.id       = orders.available_primary_key();
+            o.owner    = payer;
+            o.receiver = receiver;
+            o.quant    = quant_after_fee;
+         });
+         FSCIO_TRACE_RAM( "buyram queued payer=", payer, " receiver=", receiver, " quant=", quant_after_fee );
+         return;
+      }
+
       int64_t bytes_out;
 
-      const auto& market = _rammarket.get(ramcore_symbol.raw(), "ram market does not exist");
-      _rammarket.modify( market, same_payer, [&]( auto& es ) {
-          bytes_out = es.convert( quant_after_fee,  ram_symbol ).amount;
-      });
+      auto market = current_ram_market();
+      bytes_out = market.convert( quant_after_fee, ram_symbol ).amount;
+      set_ram_market( market );
 
+      FSCIO_TRACE_RAM( "buyram payer=", payer, " receiver=", receiver, " quant=", quant_after_fee, " bytes=", bytes_out );
       fscio_assert( bytes_out > 0, "must reserve a positive amount" );
 
       _gstate.total_ram_bytes_reserved += uint64_t(bytes_out);
       _gstate.total_ram_stake          += quant_after_fee.amount;
 
-      user_resources_table  userres( _self, receiver.value );
+      add_ram( receiver, bytes_out );
+   }
+
+   /**
+    *  Buys ram for several receivers with one market update and one payment: the bytes bought for the
+    *  combined quantity are split pro rata to each receiver's quantity, the rounding remainder goes to
+    *  the last receiver.
+    */
+   void system_contract::buyrambatch( name payer, const std::vector<std::pair<name, asset>>& receivers )
+   {
+      require_auth( payer );
+      fscio_assert( !ram_orders_batched(), "buyrambatch is not available while ram orders are batched" );
+      fscio_assert( payer != resairdrop_account, "airdrop account must buy ram for each receiver separately" );
+      fscio_assert( !receivers.empty(), "must buy ram for at least one receiver" );
+
+      asset quant( 0, core_symbol() );
+      for( const auto& [receiver, receiver_quant] : receivers ) {
+         fscio_assert( is_account( receiver ), "receiver account does not exist" );
+         fscio_assert( receiver_quant.symbol == core_symbol(), "must buy ram with core token" );
+         fscio_assert( receiver_quant.amount > 0, "must purchase a positive amount" );
+         quant += receiver_quant;
+      }
+
+      auto fee = quant;
+      fee.amount = ( fee.amount + 199 ) / 200; /// .5% fee (round up)
+      auto quant_after_fee = quant;
+      quant_after_fee.amount -= fee.amount;
+
+      INLINE_ACTION_SENDER(fscio::token, transfer)(
+         token_account, { {payer, active_permission}, {ram_account, active_permission} },
+         { payer, ram_account, quant_after_fee, std::string("buy ram") }
+      );
+
+      if( fee.amount > 0 ) {
+         INLINE_ACTION_SENDER(fscio::token, transfer)(
+            token_account, { {payer, active_permission} },
+            { payer, ramfee_account, fee, std::string("ram fee") }
+         );
+      }
+
+      int64_t bytes_out;
+
+      auto market = current_ram_market();
+      bytes_out = market.convert( quant_after_fee, ram_symbol ).amount;
+      set_ram_market( market );
+
+      FSCIO_TRACE_RAM( "buyrambatch payer=", payer, " receivers=", receivers.size(), " quant=", quant_after_fee, " bytes=", bytes_out );
+
+      _gstate.total_ram_bytes_reserved += uint64_t(bytes_out);
+      _gstate.total_ram_stake          += quant_after_fee.amount;
+
+      int64_t bytes_left = bytes_out;
+      for( size_t i = 0; i < receivers.size(); ++i ) {
+         int64_t bytes = bytes_left;
+         if( i + 1 < receivers.size() ) {
+            bytes = static_cast<int64_t>( ( static_cast<int128_t>( bytes_out ) * receivers[i].second.amount ) / quant.amount );
+         }
+         fscio_assert( bytes > 0, "must reserve a positive amount" );
+         bytes_left -= bytes;
+         add_ram( receivers[i].first, bytes );
+      }
+   }
+
+   void system_contract::add_ram( name receiver, int64_t bytes_out )
+   {
+      auto& userres = tables().userres( receiver );
       auto res_itr = userres.find( receiver.value );
       if( res_itr ==  userres.end() ) {
          res_itr = userres.emplace( receiver, [&]( auto& res ) {
@@ -187,8 +413,8 @@ namespace fsciosystem {
       auto voter_itr = _voters.find( res_itr->owner.value );
       if( voter_itr == _voters.end() || !has_field( voter_itr->flags1, voter_info::flags1_fields::ram_managed ) ) {
          int64_t ram_bytes, net, cpu;
-         get_resource_limits( res_itr->owner.value, &ram_bytes, &net, &cpu );
-         set_resource_limits( res_itr->owner.value, res_itr->ram_bytes + ram_gift_bytes, net, cpu );
+         get_account_limits( res_itr->owner, &ram_bytes, &net, &cpu );
+         set_account_limits( res_itr->owner, res_itr->ram_bytes + ram_gift_bytes, net, cpu );
       }
    }
 
@@ -200,32 +426,45 @@ namespace fsciosystem {
     */
    void system_contract::sellram( name account, int64_t kbytes ) {
       require_auth( account );
-      update_ram_supply();
 
       fscio_assert( kbytes > 0, "cannot sell negative byte" );
 
       uint64_t bytes = kbytes * 1024ull;
       
-      // When selling, first subtract airdrop RAM
-      uint32_t airdrop_ram_bytes = 0;
-      res_airdrop_table  airdrop( _self, _self.value );
-      auto airdrop_itr = airdrop.find( account.value );
-      if( airdrop_itr != airdrop.end() ) {
-         airdrop_ram_bytes = airdrop_itr->res_airdrop_ram;
-      }
-
-      user_resources_table  userres( _self, account.value );
+      fold_legacy_airdrop( account );
+      auto& userres = tables().userres( account );
       auto res_itr = userres.find( account.value );
       fscio_assert( res_itr != userres.end(), "no resource row" );
+
+      // When selling, first subtract airdrop RAM
+      uint32_t airdrop_ram_bytes = res_itr->airdrop_ram.value_or( 0 );
       fscio_assert( (res_itr->ram_bytes - airdrop_ram_bytes) >= bytes, "insufficient quota" );
 
-      asset tokens_out;
-      auto itr = _rammarket.find(ramcore_symbol.raw());
-      _rammarket.modify( itr, same_payer, [&]( auto& es ) {
-          /// the cast to int64_t of bytes is safe because we certify bytes is <= quota which is limited by prior purchases
-          tokens_out = es.convert( asset(bytes, ram_symbol), core_symbol());
-      });
+      /// lock the bytes now, onblock fills the order and credits the tokens for claimramsale
+      if( ram_orders_batched() ) {
+         auto quote = current_ram_market().convert( asset(bytes, ram_symbol), core_symbol() );
+         fscio_assert( quote.amount > 1, "token amount received from selling ram is too low" );
+
+         add_ram( account, -int64_t(bytes) );
+
+         ram_orders_table orders( _self, _self.value );
+         orders.emplace( account, [&]( auto& o ) {
+            o.id       = orders.available_primary_key();
+            o.owner    = account;
+            o.receiver = account;
+            o.quant    = asset( 0, core_symbol() );
+            o.bytes    = int64_t(bytes);
+         });
+         FSCIO_TRACE_RAM( "sellram queued account=", account, " bytes=", bytes );
+         return;
+      }
 
+      auto market = current_ram_market();
+      /// the cast to int64_t of bytes is safe because we certify bytes is <= quota which is limited by prior purchases
+      asset tokens_out = market.convert( asset(bytes, ram_symbol), core_symbol() );
+      set_ram_market( market );
+
+      FSCIO_TRACE_RAM( "sellram account=", account, " bytes=", bytes, " tokens=", tokens_out );
       fscio_assert( tokens_out.amount > 1, "token amount received from selling ram is too low" );
 
       _gstate.total_ram_bytes_reserved -= static_cast<decltype(_gstate.total_ram_bytes_reserved)>(bytes); // bytes > 0 is asserted above
@@ -241,8 +480,8 @@ namespace fsciosystem {
       auto voter_itr = _voters.find( res_itr->owner.value );
       if( voter_itr == _voters.end() || !has_field( voter_itr->flags1, voter_info::flags1_fields::ram_managed ) ) {
          int64_t ram_bytes, net, cpu;
-         get_resource_limits( res_itr->owner.value, &ram_bytes, &net, &cpu );
-         set_resource_limits( res_itr->owner.value, res_itr->ram_bytes + ram_gift_bytes, net, cpu );
+         get_account_limits( res_itr->owner, &ram_bytes, &net, &cpu );
+         set_account_limits( res_itr->owner, res_itr->ram_bytes + ram_gift_bytes, net, cpu );
       }
 
       INLINE_ACTION_SENDER(fscio::token, transfer)(
@@ -260,6 +499,135 @@ namespace fsciosystem {
       }
    }
 
+   /**
+    *  Fills the queued ram orders at one price. Buying T core worth and selling S bytes against a market
+    *  holding B bytes and Q core at a single price u keeps the bancor invariant ( Q + T - Su )( B + S - T/u ) = QB
+    *  for u = ( Q + T ) / ( B + S ), the average of both sides after all orders are in. Every fill is
+    *  rounded down, so the market never gives out more than that price allows.
+    *
+    *  Called from onblock, so nothing in here may fail and nothing is sent to the traders: sellers, and
+    *  buyers whose order is refunded, are credited in ramproceeds and collect with claimramsale. Orders
+    *  beyond max_ram_orders_per_block wait for the next block.
+    */
+   void system_contract::fill_ram_orders()
+   {
+      ram_orders_table orders( _self, _self.value );
+      if( orders.begin() == orders.end() ) return;
+
+      auto market = current_ram_market();
+
+      int128_t total_in    = 0; /// T
+      int128_t total_bytes = 0; /// S
+      uint32_t count = 0;
+      for( auto itr = orders.begin(); itr != orders.end() && count < max_ram_orders_per_block; ++itr, ++count ) {
+         total_in    += itr->quant.amount;
+         total_bytes += itr->bytes;
+      }
+
+      int128_t price_num = 0; /// Q + T
+      int128_t price_den = 0; /// B + S
+
+      /// a buy that would receive no bytes gets its core back through ramproceeds, a sell that would be
+      /// left with nothing after the fee gets its bytes back. Taking an order out moves the price against
+      /// the other side, so the check is repeated until every remaining order fills for something.
+      const uint32_t examined = count;
+      uint32_t refunded = 0;
+      for( bool changed = true; changed; ) {
+         changed   = false;
+         price_num = int128_t( market.quote.balance.amount ) + total_in;
+         price_den = int128_t( market.base.balance.amount ) + total_bytes;
+         count = 0;
+         for( auto itr = orders.begin(); itr != orders.end() && count < examined - refunded; ) {
+            if( itr->is_buy() && ( int128_t( itr->quant.amount ) * price_den ) / price_num < 1 ) {
+               total_in -= itr->quant.amount;
+               credit_ram_proceeds( itr->owner, itr->quant.amount, 0 );
+            } else if( !itr->is_buy() && ( int128_t( itr->bytes ) * price_num ) / price_den < 2 ) {
+               total_bytes -= itr->bytes;
+               add_ram( itr->owner, itr->bytes );
+            } else {
+               ++itr;
+               ++count;
+               continue;
+            }
+            itr = orders.erase( itr );
+            ++refunded;
+            changed = true;
+         }
+      }
+
+      int64_t bytes_out  = 0;
+      int64_t tokens_out = 0;
+      count = 0;
+      for( auto itr = orders.begin(); itr != orders.end() && count < examined - refunded; ++count ) {
+         if( itr->is_buy() ) {
+            const int64_t bytes = int64_t( ( int128_t( itr->quant.amount ) * price_den ) / price_num );
+            bytes_out += bytes;
+            add_ram( itr->receiver, bytes );
+         } else {
+            const int64_t tokens = int64_t( ( int128_t( itr->bytes ) * price_num ) / price_den );
+            tokens_out += tokens;
+
+            const int64_t fee = ( tokens + 199 ) / 200; /// .5% fee (round up), tokens >= 2 leaves a positive payout
+            credit_ram_proceeds( itr->owner, tokens - fee, fee );
+         }
+         itr = orders.erase( itr );
+      }
+
+      market.quote.balance.amount += int64_t( total_in ) - tokens_out;
+      market.base.balance.amount  += int64_t( total_bytes ) - bytes_out;
+      set_ram_market( market );
+
+      FSCIO_TRACE_RAM( "fill ram orders count=", count, " refunded=", refunded, " in=", int64_t( total_in ), " bytes=", int64_t( total_bytes ),
+                       " bytes_out=", bytes_out, " tokens_out=", tokens_out );
+
+      _gstate.total_ram_bytes_reserved += uint64_t( bytes_out );
+      _gstate.total_ram_bytes_reserved -= uint64_t( total_bytes );
+      _gstate.total_ram_stake          += int64_t( total_in ) - tokens_out;
+   }
+
+   void system_contract::credit_ram_proceeds( name owner, int64_t amount, int64_t fee )
+   {
+      ram_proceeds_table proceeds( _self, _self.value );
+      auto itr = proceeds.find( owner.value );
+      if( itr == proceeds.end() ) {
+         proceeds.emplace( owner, [&]( auto& p ) {
+            p.owner   = owner;
+            p.balance = asset( amount, core_symbol() );
+            p.fee     = asset( fee, core_symbol() );
+         });
+      } else {
+         proceeds.modify( itr, same_payer, [&]( auto& p ) {
+            p.balance.amount += amount;
+            p.fee.amount     += fee;
+         });
+      }
+   }
+
+   /**
+    *  Pays out what onblock credited to owner for filled sell orders and refunded buy orders, and the
+    *  fee taken from the sells.
+    */
+   void system_contract::claimramsale( name owner )
+   {
+      require_auth( owner );
+
+      ram_proceeds_table proceeds( _self, _self.value );
+      const auto& p = proceeds.get( owner.value, "no ram sale proceeds to claim" );
+
+      INLINE_ACTION_SENDER(fscio::token, transfer)(
+         token_account, { {ram_account, active_permission}, {owner, active_permission} },
+         { ram_account, owner, p.balance, std::string("sell ram") }
+      );
+      if( p.fee.amount > 0 ) {
+         INLINE_ACTION_SENDER(fscio::token, transfer)(
+            token_account, { {ram_account, active_permission} },
+            { ram_account, ramfee_account, p.fee, std::string("sell ram fee") }
+         );
+      }
+
+      proceeds.erase( p );
+   }
+
    void system_contract::changebw( name from, name receiver,
                                    const asset stake_net_delta, const asset stake_cpu_delta, bool transfer )
    {
@@ -280,217 +648,368 @@ namespace fsciosystem {
          asset zero_asset = asset(0, system_contract::get_core_symbol());
 
          //fscio_assert( transfer == true,  "When dropping network or CPU resources, transfer flag must be true" );
+         check_airdrop_limits( stake_net_delta, stake_cpu_delta );
          
-         if ( stake_cpu_delta > zero_asset ) {
-            fscio_assert( _gstate.res_airdrop_limit_cpu > zero_asset,  "The airdrop cpu resource function has been turned off" );
-            fscio_assert( stake_cpu_delta <= _gstate.res_airdrop_limit_cpu, "The airdrop cpu exceeded the maximum limit" );
-         }  
-
-         if ( stake_net_delta > zero_asset ) {
-            fscio_assert( _gstate.res_airdrop_limit_net > zero_asset,  "The airdrop net resource function has been turned off" );
-            fscio_assert( stake_net_delta <= _gstate.res_airdrop_limit_net, "The airdrop net exceeded the maximum limit" );
-         }
-         
-         res_airdrop_table  airdrop( _self, _self.value );
-         auto airdrop_itr = airdrop.find( receiver.value );
-         if( airdrop_itr != airdrop.end() ) {
+         fold_legacy_airdrop( receiver );
+         auto& userres = tables().userres( receiver );
+         auto res_itr = userres.find( receiver.value );
+         if( res_itr != userres.end() && res_itr->is_airdrop_account() ) {
             
             if ( stake_cpu_delta > zero_asset ) {
-               fscio_assert( airdrop_itr->res_airdrop_cpu == zero_asset,  "cpu resources can only be dropped once" );
-               airdrop.modify( airdrop_itr, same_payer, [&]( auto& n ) {
-                  n.res_airdrop_cpu = stake_cpu_delta;
-               });
+               fscio_assert( res_itr->airdrop_cpu.value() == zero_asset,  "cpu resources can only be dropped once" );
             }  
 
             if ( stake_net_delta > zero_asset ) {
-               fscio_assert( airdrop_itr->res_airdrop_net == zero_asset,  "net resources can only be dropped once" );
-               airdrop.modify( airdrop_itr, same_payer, [&]( auto& n ) {
-                  n.res_airdrop_net = stake_net_delta;
-               });
+               fscio_assert( res_itr->airdrop_net.value() == zero_asset,  "net resources can only be dropped once" );
             }
 
+            userres.modify( res_itr, same_payer, [&]( auto& res ) {
+               if ( stake_cpu_delta > zero_asset ) res.airdrop_cpu.value() = stake_cpu_delta;
+               if ( stake_net_delta > zero_asset ) res.airdrop_net.value() = stake_net_delta;
+            });
+
          }else {
             fscio_assert( false,  "receiver is not a airdrop account" );   
          }
       }
 
       // update stake delegated from "from" to "receiver"
-      {
-         del_bandwidth_table     del_tbl( _self, from.value );
-         auto itr = del_tbl.find( receiver.value );
+      update_delband( from, receiver, stake_net_delta, stake_cpu_delta );
+
+      // update totals of "receiver"
+      update_stake_totals( from, receiver, stake_net_delta, stake_cpu_delta );
+
+      // create refund or update from existing refund
+      if ( stake_account != source_stake_from ) { //for fscio both transfer and refund make no sense
+         auto transfer_amount = update_refund( from, receiver, stake_net_delta, stake_cpu_delta, transfer );
+         if ( 0 < transfer_amount.amount ) {
+            INLINE_ACTION_SENDER(fscio::token, transfer)(
+               token_account, { {source_stake_from, active_permission} },
+               { source_stake_from, stake_account, asset(transfer_amount), std::string("stake bandwidth") }
+            );
+         }
+      }
+
+      // update voting power
+      update_voter_stake( from, stake_net_delta + stake_cpu_delta );
+   }
+
+   void system_contract::check_airdrop_limits( const asset& net, const asset& cpu )
+   {
+      asset zero_asset = asset(0, system_contract::get_core_symbol());
+
+      if ( cpu > zero_asset ) {
+         fscio_assert( _gstate.res_airdrop_limit_cpu > zero_asset,  "The airdrop cpu resource function has been turned off" );
+         fscio_assert( cpu <= _gstate.res_airdrop_limit_cpu, "The airdrop cpu exceeded the maximum limit" );
+      }  
+
+      if ( net > zero_asset ) {
+         fscio_assert( _gstate.res_airdrop_limit_net > zero_asset,  "The airdrop net resource function has been turned off" );
+         fscio_assert( net <= _gstate.res_airdrop_limit_net, "The airdrop net exceeded the maximum limit" );
+      }
+   }
+
+   void system_contract::update_delband( name from, name receiver, const asset& stake_net_delta, const asset& stake_cpu_delta )
+   {
+      auto& del_tbl = tables().delband( from );
+      auto itr = del_tbl.find( receiver.value );
+      if( itr == del_tbl.end() ) {
+         itr = del_tbl.emplace( from, [&]( auto& dbo ){
+               dbo.from          = from;
+               dbo.to            = receiver;
+               dbo.net_weight    = stake_net_delta;
+               dbo.cpu_weight    = stake_cpu_delta;
+            });
+      }
+      else {
+         del_tbl.modify( itr, same_payer, [&]( auto& dbo ){
+               dbo.net_weight    += stake_net_delta;
+               dbo.cpu_weight    += stake_cpu_delta;
+            });
+      }
+      fscio_assert( 0 <= itr->net_weight.amount, "insufficient staked net bandwidth" );
+      fscio_assert( 0 <= itr->cpu_weight.amount, "insufficient staked cpu bandwidth" );
+
+      /// the mirror takes the totals rather than the deltas, so a delegation made before the index
+      /// existed is picked up the next time it changes
+      auto& by_to = tables().delband_by_to( receiver );
+      auto to_itr = by_to.find( from.value );
+      if ( itr->net_weight.amount == 0 && itr->cpu_weight.amount == 0 ) {
+         if( to_itr != by_to.end() ) {
+            by_to.erase( to_itr );
+         }
+         del_tbl.erase( itr );
+      } else if( to_itr == by_to.end() ) {
+         by_to.emplace( from, [&]( auto& dbo ){
+               dbo.from          = from;
+               dbo.to            = receiver;
+               dbo.net_weight    = itr->net_weight;
+               dbo.cpu_weight    = itr->cpu_weight;
+            });
+      } else {
+         by_to.modify( to_itr, same_payer, [&]( auto& dbo ){
+               dbo.net_weight    = itr->net_weight;
+               dbo.cpu_weight    = itr->cpu_weight;
+            });
+      }
+   }
+
+   /**
+    *  Prints up to limit delegations to receiver, starting at delegator lower_bound, one
+    *  "from net cpu" line each, followed by "next=<from>" when there are more. The same rows can be
+    *  read directly from the delbandto table in the scope of receiver. Delegations made before
+    *  delbandto existed only show up once they change or syncdelband has copied them.
+    */
+   void system_contract::getdelband( name receiver, name lower_bound, uint32_t limit ) {
+      fscio_assert( 0 < limit && limit <= 1000, "limit must be between 1 and 1000" );
+
+      auto& by_to = tables().delband_by_to( receiver );
+      auto itr = by_to.lower_bound( lower_bound.value );
+      for( uint32_t i = 0; i < limit && itr != by_to.end(); ++i, ++itr ) {
+         print( itr->from, " ", itr->net_weight, " ", itr->cpu_weight, "\n" );
+      }
+      if( itr != by_to.end() ) {
+         print( "next=", itr->from, "\n" );
+      }
+   }
+
+   /**
+    *  Copies the delband totals of the given (from, to) pairs into delbandto, for delegations made before
+    *  the index existed. Pairs that are already in sync are left alone and a mirror row whose delegation
+    *  is gone is removed, so the same list can be sent again safely. The backfilled rows are billed to
+    *  the system contract, the delegator never authorized them.
+    */
+   void system_contract::syncdelband( const std::vector<std::pair<name, name>>& delegations ) {
+      require_auth( _self );
+      fscio_assert( !delegations.empty(), "must sync at least one delegation" );
+
+      for( const auto& [from, to] : delegations ) {
+         auto& del_tbl = tables().delband( from );
+         auto& by_to = tables().delband_by_to( to );
+         auto itr = del_tbl.find( to.value );
+         auto to_itr = by_to.find( from.value );
          if( itr == del_tbl.end() ) {
-            itr = del_tbl.emplace( from, [&]( auto& dbo ){
+            if( to_itr != by_to.end() ) {
+               by_to.erase( to_itr );
+            }
+         } else if( to_itr == by_to.end() ) {
+            by_to.emplace( _self, [&]( auto& dbo ){
                   dbo.from          = from;
-                  dbo.to            = receiver;
-                  dbo.net_weight    = stake_net_delta;
-                  dbo.cpu_weight    = stake_cpu_delta;
+                  dbo.to            = to;
+                  dbo.net_weight    = itr->net_weight;
+                  dbo.cpu_weight    = itr->cpu_weight;
                });
-         }
-         else {
-            del_tbl.modify( itr, same_payer, [&]( auto& dbo ){
-                  dbo.net_weight    += stake_net_delta;
-                  dbo.cpu_weight    += stake_cpu_delta;
+         } else if( to_itr->net_weight != itr->net_weight || to_itr->cpu_weight != itr->cpu_weight ) {
+            by_to.modify( to_itr, same_payer, [&]( auto& dbo ){
+                  dbo.net_weight    = itr->net_weight;
+                  dbo.cpu_weight    = itr->cpu_weight;
                });
          }
-         fscio_assert( 0 <= itr->net_weight.amount, "insufficient staked net bandwidth" );
-         fscio_assert( 0 <= itr->cpu_weight.amount, "insufficient staked cpu bandwidth" );
-         if ( itr->net_weight.amount == 0 && itr->cpu_weight.amount == 0 ) {
-            del_tbl.erase( itr );
-         }
-      } // itr can be invalid, should go out of scope
+      }
+   }
+
+   void system_contract::update_stake_totals( name from, name receiver, const asset& stake_net_delta, const asset& stake_cpu_delta )
+   {
+      auto& totals_tbl = tables().userres( receiver );
+      auto tot_itr = totals_tbl.find( receiver.value );
+      if( tot_itr ==  totals_tbl.end() ) {
+         tot_itr = totals_tbl.emplace( from, [&]( auto& tot ) {
+               tot.owner = receiver;
+               tot.net_weight    = stake_net_delta;
+               tot.cpu_weight    = stake_cpu_delta;
+            });
+      } else {
+         totals_tbl.modify( tot_itr, from == receiver ? from : same_payer, [&]( auto& tot ) {
+               tot.net_weight    += stake_net_delta;
+               tot.cpu_weight    += stake_cpu_delta;
+            });
+      }
+      fscio_assert( 0 <= tot_itr->net_weight.amount, "insufficient staked total net bandwidth" );
+      fscio_assert( 0 <= tot_itr->cpu_weight.amount, "insufficient staked total cpu bandwidth" );
 
-      // update totals of "receiver"
       {
-         user_resources_table   totals_tbl( _self, receiver.value );
-         auto tot_itr = totals_tbl.find( receiver.value );
-         if( tot_itr ==  totals_tbl.end() ) {
-            tot_itr = totals_tbl.emplace( from, [&]( auto& tot ) {
-                  tot.owner = receiver;
-                  tot.net_weight    = stake_net_delta;
-                  tot.cpu_weight    = stake_cpu_delta;
-               });
-         } else {
-            totals_tbl.modify( tot_itr, from == receiver ? from : same_payer, [&]( auto& tot ) {
-                  tot.net_weight    += stake_net_delta;
-                  tot.cpu_weight    += stake_cpu_delta;
-               });
+         bool ram_managed = false;
+         bool net_managed = false;
+         bool cpu_managed = false;
+
+         auto voter_itr = _voters.find( receiver.value );
+         if( voter_itr != _voters.end() ) {
+            ram_managed = has_field( voter_itr->flags1, voter_info::flags1_fields::ram_managed );
+            net_managed = has_field( voter_itr->flags1, voter_info::flags1_fields::net_managed );
+            cpu_managed = has_field( voter_itr->flags1, voter_info::flags1_fields::cpu_managed );
          }
-         fscio_assert( 0 <= tot_itr->net_weight.amount, "insufficient staked total net bandwidth" );
-         fscio_assert( 0 <= tot_itr->cpu_weight.amount, "insufficient staked total cpu bandwidth" );
-
-         {
-            bool ram_managed = false;
-            bool net_managed = false;
-            bool cpu_managed = false;
-
-            auto voter_itr = _voters.find( receiver.value );
-            if( voter_itr != _voters.end() ) {
-               ram_managed = has_field( voter_itr->flags1, voter_info::flags1_fields::ram_managed );
-               net_managed = has_field( voter_itr->flags1, voter_info::flags1_fields::net_managed );
-               cpu_managed = has_field( voter_itr->flags1, voter_info::flags1_fields::cpu_managed );
-            }
 
-            if( !(net_managed && cpu_managed) ) {
-               int64_t ram_bytes, net, cpu;
-               get_resource_limits( receiver.value, &ram_bytes, &net, &cpu );
+         if( !(net_managed && cpu_managed) ) {
+            int64_t ram_bytes, net, cpu;
+            get_account_limits( receiver, &ram_bytes, &net, &cpu );
 
-               set_resource_limits( receiver.value,
-                                    ram_managed ? ram_bytes : std::max( tot_itr->ram_bytes + ram_gift_bytes, ram_bytes ),
-                                    net_managed ? net : tot_itr->net_weight.amount,
-                                    cpu_managed ? cpu : tot_itr->cpu_weight.amount );
-            }
+            set_account_limits( receiver,
+                                ram_managed ? ram_bytes : std::max( tot_itr->ram_bytes + ram_gift_bytes, ram_bytes ),
+                                net_managed ? net : tot_itr->net_weight.amount,
+                                cpu_managed ? cpu : tot_itr->cpu_weight.amount );
          }
+      }
 
-         if ( tot_itr->net_weight.amount == 0 && tot_itr->cpu_weight.amount == 0  && tot_itr->ram_bytes == 0 ) {
-            totals_tbl.erase( tot_itr );
-         }
-      } // tot_itr can be invalid, should go out of scope
+      /// airdrop accounts keep their row, it records what they were airdropped
+      if ( tot_itr->net_weight.amount == 0 && tot_itr->cpu_weight.amount == 0  && tot_itr->ram_bytes == 0 && !tot_itr->is_airdrop_account() ) {
+         totals_tbl.erase( tot_itr );
+      }
+   }
+
+   /**
+    *  Moves stake between the refund request of from and the delta, and keeps the refund queue in step.
+    *  Returns the part of the delta that still has to be transferred to the stake account.
+    */
+   asset system_contract::update_refund( name from, name receiver, const asset& stake_net_delta, const asset& stake_cpu_delta, bool transfer )
+   {
+      auto& refunds_tbl = tables().refunds( from );
+      auto req = refunds_tbl.find( from.value );
+
+      //create/update/delete refund
+      auto net_balance = stake_net_delta;
+      auto cpu_balance = stake_cpu_delta;
+      bool refund_pending = false;
 
-      // create refund or update from existing refund
-      if ( stake_account != source_stake_from ) { //for fscio both transfer and refund make no sense
-         refunds_table refunds_tbl( _self, from.value );
-         auto req = refunds_tbl.find( from.value );
-
-         //create/update/delete refund
-         auto net_balance = stake_net_delta;
-         auto cpu_balance = stake_cpu_delta;
-         bool need_deferred_trx = false;
-
-
-         // net and cpu are same sign by assertions in delegatebw and undelegatebw
-         // redundant assertion also at start of changebw to protect against misuse of changebw
-         bool is_undelegating = (net_balance.amount + cpu_balance.amount ) < 0;
-         bool is_delegating_to_self = (!transfer && from == receiver);
-
-         if( is_delegating_to_self || is_undelegating ) {
-            if ( req != refunds_tbl.end() ) { //need to update refund
-               refunds_tbl.modify( req, same_payer, [&]( refund_request& r ) {
-                  if ( net_balance.amount < 0 || cpu_balance.amount < 0 ) {
-                     r.request_time = current_time_point();
-                  }
-                  r.net_amount -= net_balance;
-                  if ( r.net_amount.amount < 0 ) {
-                     net_balance = -r.net_amount;
-                     r.net_amount.amount = 0;
-                  } else {
-                     net_balance.amount = 0;
-                  }
-                  r.cpu_amount -= cpu_balance;
-                  if ( r.cpu_amount.amount < 0 ){
-                     cpu_balance = -r.cpu_amount;
-                     r.cpu_amount.amount = 0;
-                  } else {
-                     cpu_balance.amount = 0;
-                  }
-               });
 
-               fscio_assert( 0 <= req->net_amount.amount, "negative net refund amount" ); //should never happen
-               fscio_assert( 0 <= req->cpu_amount.amount, "negative cpu refund amount" ); //should never happen
+      // net and cpu are same sign by assertions in delegatebw and undelegatebw
+      // redundant assertion also at start of changebw to protect against misuse of changebw
+      bool is_undelegating = (net_balance.amount + cpu_balance.amount ) < 0;
+      bool is_delegating_to_self = (!transfer && from == receiver);
 
-               if ( req->net_amount.amount == 0 && req->cpu_amount.amount == 0 ) {
-                  refunds_tbl.erase( req );
-                  need_deferred_trx = false;
+      if( is_delegating_to_self || is_undelegating ) {
+         if ( req != refunds_tbl.end() ) { //need to update refund
+            refunds_tbl.modify( req, same_payer, [&]( refund_request& r ) {
+               if ( net_balance.amount < 0 || cpu_balance.amount < 0 ) {
+                  r.request_time = current_time_point();
+               }
+               r.net_amount -= net_balance;
+               if ( r.net_amount.amount < 0 ) {
+                  net_balance = -r.net_amount;
+                  r.net_amount.amount = 0;
                } else {
-                  need_deferred_trx = true;
+                  net_balance.amount = 0;
                }
-            } else if ( net_balance.amount < 0 || cpu_balance.amount < 0 ) { //need to create refund
-               refunds_tbl.emplace( from, [&]( refund_request& r ) {
-                  r.owner = from;
-                  if ( net_balance.amount < 0 ) {
-                     r.net_amount = -net_balance;
-                     net_balance.amount = 0;
-                  } else {
-                     r.net_amount = asset( 0, core_symbol() );
-                  }
-                  if ( cpu_balance.amount < 0 ) {
-                     r.cpu_amount = -cpu_balance;
-                     cpu_balance.amount = 0;
-                  } else {
-                     r.cpu_amount = asset( 0, core_symbol() );
-                  }
-                  r.request_time = current_time_point();
-               });
-               need_deferred_trx = true;
-            } // else stake increase requested with no existing row in refunds_tbl -> nothing to do with refunds_tbl
-         } /// end if is_delegating_to_self || is_undelegating
-
-         if ( need_deferred_trx ) {
-            fscio::transaction out;
-            out.actions.emplace_back( permission_level{from, active_permission},
-                                      _self, "refund"_n,
-                                      from
-            );
-            out.delay_sec = refund_delay_sec;
-            cancel_deferred( from.value ); // TODO: Remove this line when replacing deferred trxs is fixed
-            out.send( from.value, from, true );
-         } else {
-            cancel_deferred( from.value );
-         }
+               r.cpu_amount -= cpu_balance;
+               if ( r.cpu_amount.amount < 0 ){
+                  cpu_balance = -r.cpu_amount;
+                  r.cpu_amount.amount = 0;
+               } else {
+                  cpu_balance.amount = 0;
+               }
+            });
 
-         auto transfer_amount = net_balance + cpu_balance;
-         if ( 0 < transfer_amount.amount ) {
-            INLINE_ACTION_SENDER(fscio::token, transfer)(
-               token_account, { {source_stake_from, active_permission} },
-               { source_stake_from, stake_account, asset(transfer_amount), std::string("stake bandwidth") }
-            );
-         }
+            fscio_assert( 0 <= req->net_amount.amount, "negative net refund amount" ); //should never happen
+            fscio_assert( 0 <= req->cpu_amount.amount, "negative cpu refund amount" ); //should never happen
+
+            if ( req->net_amount.amount == 0 && req->cpu_amount.amount == 0 ) {
+               refunds_tbl.erase( req );
+               dequeue_refund( from );
+               refund_pending = false;
+            } else {
+               refund_pending = true;
+            }
+         } else if ( net_balance.amount < 0 || cpu_balance.amount < 0 ) { //need to create refund
+            refunds_tbl.emplace( from, [&]( refund_request& r ) {
+               r.owner = from;
+               if ( net_balance.amount < 0 ) {
+                  r.net_amount = -net_balance;
+                  net_balance.amount = 0;
+               } else {
+                  r.net_amount = asset( 0, core_symbol() );
+               }
+               if ( cpu_balance.amount < 0 ) {
+                  r.cpu_amount = -cpu_balance;
+                  cpu_balance.amount = 0;
+               } else {
+                  r.cpu_amount = asset( 0, core_symbol() );
+               }
+               r.request_time = current_time_point();
+            });
+            refund_pending = true;
+         } // else stake increase requested with no existing row in refunds_tbl -> nothing to do with refunds_tbl
+      } /// end if is_delegating_to_self || is_undelegating
+
+      /// queued by request time instead of a deferred refund transaction, paid by refund or processrefunds
+      if ( refund_pending ) {
+         enqueue_refund( from, refunds_tbl.get( from.value ).request_time );
       }
 
-      // update voting power
-      {
-         asset total_update = stake_net_delta + stake_cpu_delta;
-         auto from_voter = _voters.find( from.value );
-         if( from_voter == _voters.end() ) {
-            from_voter = _voters.emplace( from, [&]( auto& v ) {
-                  v.owner  = from;
-                  v.staked_balance = total_update;
-               });
-         } else {
-            _voters.modify( from_voter, same_payer, [&]( auto& v ) {
-                  v.staked_balance += total_update;
-               });
-         }
-         fscio_assert( 0 <= from_voter->staked_balance.amount, "stake for voting cannot be negative");
+      return net_balance + cpu_balance;
+   }
+
+   void system_contract::update_voter_stake( name from, const asset& total_update )
+   {
+      auto from_voter = _voters.find( from.value );
+      if( from_voter == _voters.end() ) {
+         from_voter = _voters.emplace( from, [&]( auto& v ) {
+               v.owner  = from;
+               v.staked_balance = total_update;
+            });
+      } else {
+         _voters.modify( from_voter, same_payer, [&]( auto& v ) {
+               v.staked_balance += total_update;
+            });
+      }
+      fscio_assert( 0 <= from_voter->staked_balance.amount, "stake for voting cannot be negative");
+   }
+
+   /**
+    *  Moves the airdrop amounts of one row of the retired resad table onto the owner's userres row.
+    *  Returns the next row of the resad table.
+    */
+   res_airdrop_table::const_iterator system_contract::fold_legacy_airdrop( res_airdrop_table& airdrop,
+                                                                           res_airdrop_table::const_iterator itr )
+   {
+      const name owner = itr->owner;
+      auto& userres = tables().userres( owner );
+      auto res_itr = userres.find( owner.value );
+      if( res_itr == userres.end() ) {
+         userres.emplace( owner, [&]( auto& res ) {
+            res.owner = owner;
+            res.net_weight = asset( 0, core_symbol() );
+            res.cpu_weight = asset( 0, core_symbol() );
+            res.airdrop_net.emplace( itr->res_airdrop_net );
+            res.airdrop_cpu.emplace( itr->res_airdrop_cpu );
+            res.airdrop_ram.emplace( itr->res_airdrop_ram );
+         });
+      } else {
+         userres.modify( res_itr, same_payer, [&]( auto& res ) {
+            res.airdrop_net.emplace( itr->res_airdrop_net );
+            res.airdrop_cpu.emplace( itr->res_airdrop_cpu );
+            res.airdrop_ram.emplace( itr->res_airdrop_ram );
+         });
+      }
+      return airdrop.erase( itr );
+   }
+
+   /**
+    *  Accounts that have not been migrated yet are folded the first time they are touched, once
+    *  migrateresad has emptied the resad table this costs nothing.
+    */
+   void system_contract::fold_legacy_airdrop( name owner )
+   {
+      if( global_slots_cleared() && _gstate.res_airdrop_migrated ) return;
+
+      res_airdrop_table  airdrop( _self, _self.value );
+      auto itr = airdrop.find( owner.value );
+      if( itr != airdrop.end() ) {
+         fold_legacy_airdrop( airdrop, itr );
+      }
+   }
+
+   void system_contract::migrateresad( uint32_t max_rows )
+   {
+      require_auth( _self );
+      fscio_assert( global_slots_cleared(), "global state revision must be at least 2" );
+      fscio_assert( !_gstate.res_airdrop_migrated, "resad table has already been migrated" );
+
+      res_airdrop_table  airdrop( _self, _self.value );
+      auto itr = airdrop.begin();
+      for( uint32_t i = 0; i < max_rows && itr != airdrop.end(); ++i ) {
+         itr = fold_legacy_airdrop( airdrop, itr );
+      }
+      if( airdrop.begin() == airdrop.end() ) {
+         _gstate.res_airdrop_migrated = 1;
       }
    }
 
@@ -520,11 +1039,187 @@ namespace fsciosystem {
       changebw( from, receiver, -unstake_net_quantity, -unstake_cpu_quantity, false);
    } // undelegatebw
 
+   void system_contract::delegatebwmany( name from, const std::vector<bw_delegation>& delegations, bool transfer )
+   {
+      changebw_many( from, delegations, false, transfer );
+   }
+
+   void system_contract::undelegatebwmany( name from, const std::vector<bw_delegation>& delegations )
+   {
+      fscio_assert( _gstate.total_activated_stake >= get_min_activated_stake(),
+                    "cannot undelegate bandwidth until the chain is activated (at least 15% of all tokens participate in voting)" );
+
+      changebw_many( from, delegations, true, false );
+   }
+
+   /**
+    *  changebw for a list of receivers of the same 'from'. The delband and userres rows of every receiver
+    *  are still written once each, but the refund request, the transfer to the stake account and the
+    *  voter of 'from' are updated once for the whole list. With the transfer flag every receiver owns its
+    *  stake, so the voter rows are updated per receiver.
+    */
+   void system_contract::changebw_many( name from, const std::vector<bw_delegation>& delegations, bool undelegate, bool transfer )
+   {
+      require_auth( from );
+      fscio_assert( !delegations.empty(), "must change the bandwidth of at least one receiver" );
+      fscio_assert( from != resairdrop_account && from != stake_account, "account must use delegatebw or undelegatebw" );
+
+      /// every receiver once, the per receiver checks below only hold for a single change
+      std::vector<name> receivers;
+      receivers.reserve( delegations.size() );
+      for( const auto& d : delegations ) {
+         receivers.push_back( d.receiver );
+      }
+      std::sort( receivers.begin(), receivers.end() );
+      fscio_assert( std::adjacent_find( receivers.begin(), receivers.end() ) == receivers.end(), "duplicate receiver" );
+
+      const asset zero_asset( 0, core_symbol() );
+      asset refund_net  = zero_asset; /// stake that may be covered by or returned to the refund request of from
+      asset refund_cpu  = zero_asset;
+      asset stake_total = zero_asset; /// stake transferred from 'from' to the stake account
+      asset voter_total = zero_asset; /// change of the voting power of 'from'
+
+      for( const auto& d : delegations ) {
+         fscio_assert( d.net_quantity.symbol == core_symbol() && d.cpu_quantity.symbol == core_symbol(), "must use core token" );
+         fscio_assert( d.net_quantity >= zero_asset && d.cpu_quantity >= zero_asset, "must stake a positive amount" );
+         fscio_assert( d.net_quantity.amount + d.cpu_quantity.amount > 0, "must stake a positive amount" );
+         fscio_assert( !transfer || from != d.receiver, "cannot use transfer flag if delegating to self" );
+
+         const asset net = undelegate ? -d.net_quantity : d.net_quantity;
+         const asset cpu = undelegate ? -d.cpu_quantity : d.cpu_quantity;
+         const name owner = transfer ? d.receiver : from;
+
+         update_delband( owner, d.receiver, net, cpu );
+         update_stake_totals( owner, d.receiver, net, cpu );
+
+         if( transfer ) {
+            stake_total += net + cpu;
+            update_voter_stake( d.receiver, net + cpu );
+            continue;
+         }
+
+         if( undelegate || d.receiver == from ) {
+            refund_net += net;
+            refund_cpu += cpu;
+         } else {
+            stake_total += net + cpu;
+         }
+         voter_total += net + cpu;
+      }
+
+      if( refund_net.amount != 0 || refund_cpu.amount != 0 ) {
+         stake_total += update_refund( from, from, refund_net, refund_cpu, false );
+      }
+
+      if( 0 < stake_total.amount ) {
+         INLINE_ACTION_SENDER(fscio::token, transfer)(
+            token_account, { {from, active_permission} },
+            { from, stake_account, stake_total, std::string("stake bandwidth") }
+         );
+      }
+
+      if( !transfer ) {
+         update_voter_stake( from, voter_total );
+      }
+   }
+
+   /**
+    *  Airdrops the same ram, net and cpu to every receiver in one pass. The limits are checked once,
+    *  every airdrop row is written once, the ram for the whole batch is bought with one market update
+    *  and the stake is moved with a single transfer. The stake is transferred to the receivers, like
+    *  delegatebw with the transfer flag.
+    */
+   void system_contract::airdropres( const std::vector<name>& receivers, uint32_t ram_bytes, asset net, asset cpu )
+   {
+      require_auth( resairdrop_account );
+
+      asset zero_asset( 0, core_symbol() );
+      fscio_assert( !receivers.empty(), "must airdrop to at least one receiver" );
+      fscio_assert( net.symbol == core_symbol() && cpu.symbol == core_symbol(), "must airdrop core token" );
+      fscio_assert( net >= zero_asset && cpu >= zero_asset, "must airdrop a positive amount" );
+      fscio_assert( ram_bytes > 0 || net.amount > 0 || cpu.amount > 0, "must airdrop a positive amount" );
+      if ( ram_bytes > 0 ) {
+         fscio_assert( !ram_orders_batched(), "ram cannot be airdropped while ram orders are batched" );
+         fscio_assert( _gstate.res_airdrop_limit_ram_bytes > 0,  "The airdrop memory resource function has been turned off" );
+         fscio_assert( ram_bytes <= _gstate.res_airdrop_limit_ram_bytes, "The airdrop memory exceeded the maximum limit" );
+      }
+      check_airdrop_limits( net, cpu );
+
+      /// buy the ram of the whole batch at once, the few bytes rounding leaves over stay in the market
+      /// so that every receiver gets exactly ram_bytes and none goes over the airdrop limit
+      if ( ram_bytes > 0 ) {
+         const int64_t total_bytes = int64_t(ram_bytes) * int64_t(receivers.size());
+         auto quant = ram_price_with_fee( total_bytes );
+         auto fee = quant;
+         fee.amount = ( fee.amount + 199 ) / 200; /// .5% fee (round up)
+         auto quant_after_fee = quant;
+         quant_after_fee.amount -= fee.amount;
+
+         INLINE_ACTION_SENDER(fscio::token, transfer)(
+            token_account, { {resairdrop_account, active_permission}, {ram_account, active_permission} },
+            { resairdrop_account, ram_account, quant_after_fee, std::string("buy ram") }
+         );
+
+         if( fee.amount > 0 ) {
+            INLINE_ACTION_SENDER(fscio::token, transfer)(
+               token_account, { {resairdrop_account, active_permission} },
+               { resairdrop_account, ramfee_account, fee, std::string("ram fee") }
+            );
+         }
+
+         auto market = current_ram_market();
+         const int64_t bytes_out = market.convert( quant_after_fee, ram_symbol ).amount;
+         fscio_assert( bytes_out >= total_bytes, "ram market returned less than requested" );
+         market.base.balance.amount += bytes_out - total_bytes;
+         set_ram_market( market );
+
+         _gstate.total_ram_bytes_reserved += uint64_t(total_bytes);
+         _gstate.total_ram_stake          += quant_after_fee.amount;
+      }
+
+      for( const name receiver : receivers ) {
+         const int64_t receiver_bytes = int64_t(ram_bytes);
+
+         fold_legacy_airdrop( receiver );
+         auto& userres = tables().userres( receiver );
+         const auto& res = userres.get( receiver.value, "receiver is not a airdrop account" );
+         fscio_assert( res.is_airdrop_account(), "receiver is not a airdrop account" );
+         fscio_assert( ram_bytes == 0 || res.airdrop_ram.value() == 0, "memory resources can only be dropped once" );
+         fscio_assert( net.amount == 0 || res.airdrop_net.value() == zero_asset, "net resources can only be dropped once" );
+         fscio_assert( cpu.amount == 0 || res.airdrop_cpu.value() == zero_asset, "cpu resources can only be dropped once" );
+         userres.modify( res, same_payer, [&]( auto& r ) {
+            if ( ram_bytes > 0 ) r.airdrop_ram.value() = static_cast<uint32_t>( receiver_bytes );
+            if ( net.amount > 0 ) r.airdrop_net.value() = net;
+            if ( cpu.amount > 0 ) r.airdrop_cpu.value() = cpu;
+         });
+
+         if ( receiver_bytes > 0 ) {
+            add_ram( receiver, receiver_bytes );
+         }
+         if ( net.amount > 0 || cpu.amount > 0 ) {
+            update_delband( receiver, receiver, net, cpu );
+            update_stake_totals( receiver, receiver, net, cpu );
+            update_voter_stake( receiver, net + cpu );
+         }
+      }
+
+      FSCIO_TRACE_RAM( "airdropres receivers=", receivers.size(), " ram_bytes=", ram_bytes,
+                       " net=", net, " cpu=", cpu );
+
+      const auto stake = ( net + cpu ) * static_cast<int64_t>( receivers.size() );
+      if ( stake.amount > 0 ) {
+         INLINE_ACTION_SENDER(fscio::token, transfer)(
+            token_account, { {resairdrop_account, active_permission} },
+            { resairdrop_account, stake_account, stake, std::string("stake bandwidth") }
+         );
+      }
+   }
+
 
    void system_contract::refund( const name owner ) {
       require_auth( owner );
 
-      refunds_table refunds_tbl( _self, owner.value );
+      auto& refunds_tbl = tables().refunds( owner );
       auto req = refunds_tbl.find( owner.value );
       fscio_assert( req != refunds_tbl.end(), "refund request not found" );
       fscio_assert( req->request_time + seconds(refund_delay_sec) <= current_time_point(),
@@ -536,6 +1231,57 @@ namespace fsciosystem {
       );
 
       refunds_tbl.erase( req );
+      dequeue_refund( owner );
+   }
+
+   /**
+    *  Anyone may pay out the matured refunds of up to max_refunds_per_action owners. Owners without a
+    *  refund request or whose request has not matured are skipped, so a stale list does no harm; an owner
+    *  that rejects the transfer fails only the batches it is put in and can still claim with refund.
+    */
+   void system_contract::processrefunds( const std::vector<name>& owners ) {
+      fscio_assert( !owners.empty(), "must process at least one refund" );
+      fscio_assert( owners.size() <= max_refunds_per_action, "too many refunds in one action" );
+
+      const auto now = current_time_point();
+      for( const name owner : owners ) {
+         auto& refunds_tbl = tables().refunds( owner );
+         auto req = refunds_tbl.find( owner.value );
+         if( req == refunds_tbl.end() || req->request_time + seconds(refund_delay_sec) > now ) {
+            continue;
+         }
+
+         INLINE_ACTION_SENDER(fscio::token, transfer)(
+            token_account, { {stake_account, active_permission} },
+            { stake_account, owner, req->net_amount + req->cpu_amount, std::string("unstake") }
+         );
+
+         refunds_tbl.erase( req );
+         dequeue_refund( owner );
+      }
+   }
+
+   void system_contract::enqueue_refund( name owner, time_point_sec request_time ) {
+      refund_queue_table queue( _self, _self.value );
+      auto itr = queue.find( owner.value );
+      if( itr == queue.end() ) {
+         queue.emplace( owner, [&]( auto& q ) {
+            q.owner        = owner;
+            q.request_time = request_time;
+         });
+      } else if( itr->request_time != request_time ) {
+         queue.modify( itr, same_payer, [&]( auto& q ) {
+            q.request_time = request_time;
+         });
+      }
+   }
+
+   void system_contract::dequeue_refund( name owner ) {
+      refund_queue_table queue( _self, _self.value );
+      auto itr = queue.find( owner.value );
+      if( itr != queue.end() ) {
+         queue.erase( itr );
+      }
    }
 
 
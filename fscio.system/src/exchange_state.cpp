@@ -1,16 +1,84 @@
 #include <fscio.system/exchange_state.hpp>
 
+#include <limits>
+
 namespace fsciosystem {
-   asset exchange_state::convert_to_exchange( connector& c, asset in ) {
 
-      real_type R(supply.amount);
-      real_type C(c.balance.amount+in.amount);
-      real_type F(c.weight);
-      real_type T(in.amount);
-      real_type ONE(1.0);
+   namespace {
+      typedef unsigned __int128 uint128_t;
+
+      /// fixed point scale of the integer bancor math, ratios live in [1,2) so 2^62 leaves one bit of headroom
+      constexpr uint32_t  fixed_bits = 62;
+      constexpr uint128_t fixed_one  = uint128_t(1) << fixed_bits;
+
+      /// floor( sqrt( x ) ), bit by bit so it costs the same for every input
+      uint128_t isqrt( uint128_t x ) {
+         uint128_t result = 0;
+         uint128_t bit    = uint128_t(1) << 126;
+         while( bit > x ) bit >>= 2;
+         while( bit != 0 ) {
+            if( x >= result + bit ) {
+               x      -= result + bit;
+               result  = ( result >> 1 ) + bit;
+            } else {
+               result >>= 1;
+            }
+            bit >>= 2;
+         }
+         return result;
+      }
 
-      real_type E = -R * (ONE - std::pow( ONE + T / C, F) );
-      int64_t issued = int64_t(E);
+      /**
+       *  With a connector weight of 0.5 the bancor powers are a square root and a square, so both
+       *  directions can be computed with integers only. Every intermediate result is rounded down,
+       *  which means the market never issues or pays out more than the exact curve allows.
+       */
+      bool is_square_root_curve( const exchange_state::connector& c, const asset& in ) {
+         return c.weight == 0.5 && in.amount >= 0;
+      }
+   }
+
+   /**
+    *  Going through the supply token with two 0.5 weight connectors cancels out: the supply issued for
+    *  the input is exactly burned again for the output, and what remains is
+    *
+    *     out = to.balance * in / ( from.balance + in )
+    *
+    *  Only valid when both connectors are square root curves.
+    */
+   asset exchange_state::convert_direct( connector& from, connector& to, asset in ) {
+      const uint128_t T( in.amount );
+      const int64_t out = int64_t( ( uint128_t( to.balance.amount ) * T ) / ( uint128_t( from.balance.amount ) + T ) );
+
+      from.balance.amount += in.amount;
+      to.balance.amount   -= out;
+
+      return asset( out, to.balance.symbol );
+   }
+
+   asset exchange_state::convert_to_exchange( connector& c, asset in ) {
+
+      int64_t issued = 0;
+      if( is_square_root_curve( c, in ) ) {
+         // E = R * ( sqrt( 1 + T / C ) - 1 ) with C the connector balance after the deposit
+         const uint128_t R( supply.amount );
+         const uint128_t C( c.balance.amount + in.amount );
+         const uint128_t T( in.amount );
+         if( T > 0 ) {
+            const uint128_t ratio = ( ( C + T ) << fixed_bits ) / C;   // 1 + T / C, rounded down
+            const uint128_t root  = isqrt( ratio << fixed_bits );       // sqrt( 1 + T / C ), rounded down
+            issued = int64_t( ( R * ( root - fixed_one ) ) >> fixed_bits );
+         }
+      } else {
+         real_type R(supply.amount);
+         real_type C(c.balance.amount+in.amount);
+         real_type F(c.weight);
+         real_type T(in.amount);
+         real_type ONE(1.0);
+
+         real_type E = -R * (ONE - std::pow( ONE + T / C, F) );
+         issued = int64_t(E);
+      }
 
       supply.amount += issued;
       c.balance.amount += in.amount;
@@ -21,21 +89,39 @@ namespace fsciosystem {
    asset exchange_state::convert_from_exchange( connector& c, asset in ) {
       fscio_assert( in.symbol== supply.symbol, "unexpected asset symbol input" );
 
-      real_type R(supply.amount - in.amount);
-      real_type C(c.balance.amount);
-      real_type F(1.0/c.weight);
-      real_type E(in.amount);
-      real_type ONE(1.0);
-
-
-     // potentially more accurate: 
-     // The functions std::expm1 and std::log1p are useful for financial calculations, for example, 
-     // when calculating small daily interest rates: (1+x)n
-     // -1 can be expressed as std::expm1(n * std::log1p(x)). 
-     // real_type T = C * std::expm1( F * std::log1p(E/R) );
-      
-      real_type T = C * (std::pow( ONE + E/R, F) - ONE);
-      int64_t out = int64_t(T);
+      int64_t out = 0;
+      if( is_square_root_curve( c, in ) ) {
+         // T = C * ( ( 1 + E / R )^2 - 1 ) = C * E * ( 2R + E ) / R^2, rounded down
+         fscio_assert( supply.amount - in.amount > 0, "exchange supply exhausted" );
+         const uint128_t R( supply.amount - in.amount );
+         const uint128_t C( c.balance.amount );
+         const uint128_t E( in.amount );
+         const uint128_t B = 2 * R + E;
+
+         // split C * E = q * R + rem so the product with B stays within 128 bits
+         const uint128_t q   = ( C * E ) / R;
+         const uint128_t rem = ( C * E ) % R;
+         fscio_assert( q == 0 || q <= ( ~uint128_t(0) - B ) / B, "overflow in exchange conversion" );
+         const uint128_t T = ( q * B + ( rem * B ) / R ) / R;
+         fscio_assert( T <= uint128_t( std::numeric_limits<int64_t>::max() ), "overflow in exchange conversion" );
+         out = int64_t(T);
+      } else {
+         real_type R(supply.amount - in.amount);
+         real_type C(c.balance.amount);
+         real_type F(1.0/c.weight);
+         real_type E(in.amount);
+         real_type ONE(1.0);
+
+
+        // potentially more accurate: 
+        // The functions std::expm1 and std::log1p are useful for financial calculations, for example, 
+        // when calculating small daily interest rates: (1+x)n
+        // -1 can be expressed as std::expm1(n * std::log1p(x)). 
+        // real_type T = C * std::expm1( F * std::log1p(E/R) );
+         
+         real_type T = C * (std::pow( ONE + E/R, F) - ONE);
+         out = int64_t(T);
+      }
 
       supply.amount -= in.amount;
       c.balance.amount -= out;
@@ -49,6 +135,15 @@ namespace fsciosystem {
       auto base_symbol  = base.balance.symbol;
       auto quote_symbol = quote.balance.symbol;
 
+      if( sell_symbol == base_symbol && to == quote_symbol &&
+          is_square_root_curve( base, from ) && is_square_root_curve( quote, from ) ) {
+         return convert_direct( base, quote, from );
+      }
+      if( sell_symbol == quote_symbol && to == base_symbol &&
+          is_square_root_curve( quote, from ) && is_square_root_curve( base, from ) ) {
+         return convert_direct( quote, base, from );
+      }
+
       //print( "From: ", from, " TO ", asset( 0,to), "\n" );
       //print( "base: ", base_symbol, "\n" );
       //print( "quote: ", quote_symbol, "\n" );
@@ -78,6 +173,28 @@ namespace fsciosystem {
       return from;
    }
 
+   asset exchange_state::required_input( const asset& out, const symbol& from_symbol )const {
+      const connector* from = nullptr;
+      const connector* to   = nullptr;
+      if( from_symbol == base.balance.symbol && out.symbol == quote.balance.symbol ) {
+         from = &base;
+         to   = &quote;
+      } else if( from_symbol == quote.balance.symbol && out.symbol == base.balance.symbol ) {
+         from = &quote;
+         to   = &base;
+      }
+
+      if( from && is_square_root_curve( *from, out ) && is_square_root_curve( *to, out ) ) {
+         // smallest in with to.balance * in / ( from.balance + in ) >= out, rounded up
+         fscio_assert( out.amount < to->balance.amount, "insufficient connector balance" );
+         const uint128_t num = uint128_t( from->balance.amount ) * uint128_t( out.amount );
+         const uint128_t den = uint128_t( to->balance.amount - out.amount );
+         return asset( int64_t( ( num + den - 1 ) / den ), from_symbol );
+      }
 
+      /// other curves are priced by selling out back to the market, as before
+      auto tmp = *this;
+      return tmp.convert( out, from_symbol );
+   }
 
 } /// namespace fsciosystem
@@ -14,12 +14,18 @@ namespace fsciosystem {
    :native(s,code,ds),
     _voters(_self, _self.value),
     _producers(_self, _self.value),
+    _prodstats(_self, _self.value),
     _global(_self, _self.value),
     _rammarket(_self, _self.value)
    {
 
       //print( "construct system\n" );
-      _gstate  = _global.exists() ? _global.get() : get_default_parameters();
+      if( _global.exists() ) {
+         _gstate = _global.get();
+         _gstate_packed = fscio::pack( _gstate );
+      } else {
+         _gstate = get_default_parameters();
+      }
    }
 
    fscio_global_state system_contract::get_default_parameters() {
@@ -28,14 +34,23 @@ namespace fsciosystem {
       return dp;
    }
 
+   /// the native benchmark build runs many actions in one process, so it cannot cache the time
    time_point system_contract::current_time_point() {
+#ifdef FSCIO_NATIVE
+      return time_point{ microseconds{ static_cast<int64_t>( current_time() ) } };
+#else
       const static time_point ct{ microseconds{ static_cast<int64_t>( current_time() ) } };
       return ct;
+#endif
    }
 
    block_timestamp system_contract::current_block_time() {
+#ifdef FSCIO_NATIVE
+      return block_timestamp{ current_time_point() };
+#else
       const static block_timestamp cbt{ current_time_point() };
       return cbt;
+#endif
    }
 
    symbol system_contract::core_symbol()const {
@@ -43,46 +58,114 @@ namespace fsciosystem {
       return sym;
    }
 
+   /**
+    *  reserved4..reserved8 of the global state are used from revision 2 on. Nothing wrote them before,
+    *  so their contents are only trusted once updtrevision has cleared them on the way to revision 2.
+    */
+   bool system_contract::global_slots_cleared()const {
+      return _gstate.revision >= 2;
+   }
+
+   bool system_contract::ram_orders_batched()const {
+      return global_slots_cleared() && _gstate.ram_batch_mode != 0;
+   }
+
    system_contract::~system_contract() {
-      _global.set( _gstate, _self );
+      for( const auto& [account, limits] : _pending_limits ) {
+         set_resource_limits( account, limits.ram_bytes, limits.net_weight, limits.cpu_weight );
+      }
+      /// most actions leave the global state alone, compare the serialized form rather than rewriting it
+      if( fscio::pack( _gstate ) != _gstate_packed ) {
+         _global.set( _gstate, _self );
+      }
+   }
+
+   /**
+    *  Resource limits of account as this action has left them so far.
+    */
+   void native::get_account_limits( name account, int64_t* ram_bytes, int64_t* net_weight, int64_t* cpu_weight ) {
+      auto itr = _pending_limits.find( account.value );
+      if( itr == _pending_limits.end() ) {
+         get_resource_limits( account.value, ram_bytes, net_weight, cpu_weight );
+         return;
+      }
+      *ram_bytes  = itr->second.ram_bytes;
+      *net_weight = itr->second.net_weight;
+      *cpu_weight = itr->second.cpu_weight;
+   }
+
+   /**
+    *  Records the resource limits of account, they are set once when the action finishes however often
+    *  they change before that.
+    */
+   void native::set_account_limits( name account, int64_t ram_bytes, int64_t net_weight, int64_t cpu_weight ) {
+      _pending_limits[account.value] = { ram_bytes, net_weight, cpu_weight };
    }
 
    void system_contract::setram( uint64_t max_ram_size ) {
       require_auth( _self );
 
-      fscio_assert( _gstate.max_ram_size < max_ram_size, "ram may only be increased" ); /// decreasing ram might result market maker issues
+      const uint64_t current_max = _gstate.max_ram_size + pending_ram_growth();
+      fscio_assert( current_max < max_ram_size, "ram may only be increased" ); /// decreasing ram might result market maker issues
       fscio_assert( max_ram_size < 1024ll*1024*1024*1024*1024, "ram size is unrealistic" );
       fscio_assert( max_ram_size > _gstate.total_ram_bytes_reserved, "attempt to set max below reserved" );
 
-      auto delta = int64_t(max_ram_size) - int64_t(_gstate.max_ram_size);
-      auto itr = _rammarket.find(ramcore_symbol.raw());
-
       /**
        *  Increase the amount of ram for sale based upon the change in max ram size.
        */
-      _rammarket.modify( itr, same_payer, [&]( auto& m ) {
-         m.base.balance.amount += delta;
-      });
+      auto market = current_ram_market();
+      market.base.balance.amount += int64_t(max_ram_size) - int64_t(current_max);
+      set_ram_market( market );
 
       _gstate.max_ram_size = max_ram_size;
    }
 
+   /**
+    *  Folds the supply growth since last_ram_increase into max_ram_size and the ram market. Trades do
+    *  not call this, they write the market they got from current_ram_market through set_ram_market,
+    *  which settles the growth as part of the same write.
+    */
    void system_contract::update_ram_supply() {
+      if( pending_ram_growth() > 0 ) {
+         set_ram_market( current_ram_market() );
+      } else if( current_block_time() > _gstate.last_ram_increase ) {
+         _gstate.last_ram_increase = current_block_time();
+      }
+   }
+
+   /**
+    *  Bytes added to the supply since last_ram_increase at new_ram_per_block. They are part of the
+    *  market only virtually until the next write of the ram market.
+    */
+   int64_t system_contract::pending_ram_growth()const {
       auto cbt = current_block_time();
+      if( cbt <= _gstate.last_ram_increase ) return 0;
+      return int64_t(cbt.slot - _gstate.last_ram_increase.slot)*_gstate.new_ram_per_block;
+   }
 
-      if( cbt <= _gstate.last_ram_increase ) return;
+   /**
+    *  The ram market as it stands in this block, pending supply growth included, without writing anything.
+    */
+   exchange_state system_contract::current_ram_market()const {
+      auto market = _rammarket.get( ramcore_symbol.raw(), "ram market does not exist" );
+      market.base.balance.amount += pending_ram_growth();
+      return market;
+   }
 
-      auto itr = _rammarket.find(ramcore_symbol.raw());
-      auto new_ram = (cbt.slot - _gstate.last_ram_increase.slot)*_gstate.new_ram_per_block;
-      _gstate.max_ram_size += new_ram;
+   /**
+    *  Writes back a market obtained from current_ram_market in this action and records the supply
+    *  growth it includes.
+    */
+   void system_contract::set_ram_market( const exchange_state& market ) {
+      _gstate.max_ram_size += pending_ram_growth();
+      if( current_block_time() > _gstate.last_ram_increase ) {
+         _gstate.last_ram_increase = current_block_time();
+      }
 
-      /**
-       *  Increase the amount of ram for sale based upon the change in max ram size.
-       */
+      const auto& itr = _rammarket.get( ramcore_symbol.raw(), "ram market does not exist" );
       _rammarket.modify( itr, same_payer, [&]( auto& m ) {
-         m.base.balance.amount += new_ram;
+         m = market;
       });
-      _gstate.last_ram_increase = cbt;
    }
 
    /**
@@ -99,6 +182,16 @@ namespace fsciosystem {
       _gstate.new_ram_per_block = bytes_per_block;
    }
 
+   /**
+    *  Orders already queued are still filled by onblock after batch mode is switched off.
+    */
+   void system_contract::setrambatch( bool enabled ) {
+      require_auth( _self );
+      fscio_assert( global_slots_cleared(), "global state revision must be at least 2" );
+
+      _gstate.ram_batch_mode = enabled ? 1 : 0;
+   }
+
    void system_contract::setparams( const fscio::blockchain_parameters& params ) {
       require_auth( _self );
       (fscio::blockchain_parameters&)(_gstate) = params;
@@ -114,7 +207,7 @@ namespace fsciosystem {
    void system_contract::setalimits( name account, int64_t ram, int64_t net, int64_t cpu ) {
       require_auth( _self );
 
-      user_resources_table userres( _self, account.value );
+      auto& userres = tables().userres( account );
       auto ritr = userres.find( account.value );
       fscio_assert( ritr == userres.end(), "only supports unlimited accounts" );
 
@@ -126,14 +219,14 @@ namespace fsciosystem {
          fscio_assert( !(ram_managed || net_managed || cpu_managed), "cannot use setalimits on an account with managed resources" );
       }
 
-      set_resource_limits( account.value, ram, net, cpu );
+      set_account_limits( account, ram, net, cpu );
    }
 
    void system_contract::setacctram( name account, std::optional<int64_t> ram_bytes ) {
       require_auth( _self );
 
       int64_t current_ram, current_net, current_cpu;
-      get_resource_limits( account.value, &current_ram, &current_net, &current_cpu );
+      get_account_limits( account, &current_ram, &current_net, &current_cpu );
 
       int64_t ram = 0;
 
@@ -142,7 +235,7 @@ namespace fsciosystem {
          fscio_assert( vitr != _voters.end() && has_field( vitr->flags1, voter_info::flags1_fields::ram_managed ),
                        "RAM of account is already unmanaged" );
 
-         user_resources_table userres( _self, account.value );
+         auto& userres = tables().userres( account );
          auto ritr = userres.find( account.value );
 
          ram = ram_gift_bytes;
@@ -171,14 +264,14 @@ namespace fsciosystem {
          ram = *ram_bytes;
       }
 
-      set_resource_limits( account.value, ram, current_net, current_cpu );
+      set_account_limits( account, ram, current_net, current_cpu );
    }
 
    void system_contract::setacctnet( name account, std::optional<int64_t> net_weight ) {
       require_auth( _self );
 
       int64_t current_ram, current_net, current_cpu;
-      get_resource_limits( account.value, &current_ram, &current_net, &current_cpu );
+      get_account_limits( account, &current_ram, &current_net, &current_cpu );
 
       int64_t net = 0;
 
@@ -187,7 +280,7 @@ namespace fsciosystem {
          fscio_assert( vitr != _voters.end() && has_field( vitr->flags1, voter_info::flags1_fields::net_managed ),
                        "Network bandwidth of account is already unmanaged" );
 
-         user_resources_table userres( _self, account.value );
+         auto& userres = tables().userres( account );
          auto ritr = userres.find( account.value );
 
          if( ritr != userres.end() ) {
@@ -215,14 +308,14 @@ namespace fsciosystem {
          net = *net_weight;
       }
 
-      set_resource_limits( account.value, current_ram, net, current_cpu );
+      set_account_limits( account, current_ram, net, current_cpu );
    }
 
    void system_contract::setacctcpu( name account, std::optional<int64_t> cpu_weight ) {
       require_auth( _self );
 
       int64_t current_ram, current_net, current_cpu;
-      get_resource_limits( account.value, &current_ram, &current_net, &current_cpu );
+      get_account_limits( account, &current_ram, &current_net, &current_cpu );
 
       int64_t cpu = 0;
 
@@ -231,7 +324,7 @@ namespace fsciosystem {
          fscio_assert( vitr != _voters.end() && has_field( vitr->flags1, voter_info::flags1_fields::cpu_managed ),
                        "CPU bandwidth of account is already unmanaged" );
 
-         user_resources_table userres( _self, account.value );
+         auto& userres = tables().userres( account );
          auto ritr = userres.find( account.value );
 
          if( ritr != userres.end() ) {
@@ -259,7 +352,7 @@ namespace fsciosystem {
          cpu = *cpu_weight;
       }
 
-      set_resource_limits( account.value, current_ram, current_net, cpu );
+      set_account_limits( account, current_ram, current_net, cpu );
    }
 
    void system_contract::rmvproducer( name producer ) {
@@ -275,8 +368,15 @@ namespace fsciosystem {
       require_auth( _self );
       fscio_assert( _gstate.revision < 255, "can not increment revision" ); // prevent wrap around
       fscio_assert( revision == _gstate.revision + 1, "can only increment revision by one" );
-      fscio_assert( revision <= 1, // set upper bound to greatest revision supported in the code
+      fscio_assert( revision <= 2, // set upper bound to greatest revision supported in the code
                     "specified revision is not yet supported by the code" );
+      if( revision == 2 ) {
+         _gstate.vote_weight_week            = 0;
+         _gstate.vote_weight_multiplier      = 0;
+         _gstate.last_proposed_schedule_hash = 0;
+         _gstate.res_airdrop_migrated        = 0;
+         _gstate.ram_batch_mode              = 0;
+      }
       _gstate.revision = revision;
    }
 
@@ -397,25 +497,16 @@ namespace fsciosystem {
         res.owner = newact;
         res.net_weight = asset( 0, system_contract::get_core_symbol() );
         res.cpu_weight = asset( 0, system_contract::get_core_symbol() );
+
+        /// set res airdrop info  
+        if ( creator == system_contract::resairdrop_account ) {
+           res.airdrop_net.emplace( asset( 0, system_contract::get_core_symbol() ) );
+           res.airdrop_cpu.emplace( asset( 0, system_contract::get_core_symbol() ) );
+           res.airdrop_ram.emplace( 0 );
+        }
       });
 
-      set_resource_limits( newact.value, 0, 0, 0 );
-
-      /// set res airdrop info  
-      if ( creator == system_contract::resairdrop_account )
-      {
-         res_airdrop_table airdrop(_self, _self.value);
-         auto airdrop_itr = airdrop.find(newact.value);
-         if (airdrop_itr == airdrop.end())
-         {
-            airdrop.emplace(newact, [&](auto &resad) {
-               resad.owner = newact;
-               resad.res_airdrop_net = asset(0, system_contract::get_core_symbol());
-               resad.res_airdrop_cpu = asset(0, system_contract::get_core_symbol());
-               resad.res_airdrop_ram = 0;
-            });
-         }
-      }
+      set_account_limits( newact, 0, 0, 0 );
    }
 
    void native::setabi( name acnt, const std::vector<char>& abi ) {
@@ -475,9 +566,9 @@ FSCIO_DISPATCH( fsciosystem::system_contract,
      (init)(setram)(setramrate)(setparams)(setpriv)(setalimits)(setacctram)(setacctnet)(setacctcpu)
      (rmvproducer)(updtrevision)(bidname)(bidrefund)(setresadcfg)
      // delegate_bandwidth.cpp
-     (buyramkbytes)(sellram)(delegatebw)(undelegatebw)(refund)
+     (buyramkbytes)(buyramlimit)(buyrambatch)(sellram)(sellramlimit)(quoteram)(delegatebw)(undelegatebw)(delegatebwmany)(undelegatebwmany)(getdelband)(syncdelband)(refund)(processrefunds)(airdropres)(migrateresad)(setrambatch)(claimramsale)
      // voting.cpp
-     (regproducer)(unregprod)(voteproducer)
+     (regproducer)(unregprod)(voteproducer)(voteproducers)(recountvotes)
      // producer_pay.cpp
-     (onblock)(claimprod)(claimvoter)
+     (onblock)(claimprod)(claimvoter)(claimall)
 )
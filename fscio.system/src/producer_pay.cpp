@@ -1,4 +1,5 @@
 #include <fscio.system/fscio.system.hpp>
+#include <fscio.system/trace.hpp>
 
 #include <fscio.token/fscio.token.hpp>
 #include <math.h>
@@ -33,6 +34,9 @@ namespace fsciosystem {
       // is eventually completely removed, at which point this line can be removed.
       _gstate.last_block_num = timestamp;
 
+      /// the ram market does not depend on activation
+      fill_ram_orders();
+
       /** until activated stake crosses this threshold no new rewards are paid */
       if( _gstate.total_activated_stake < get_min_activated_stake() )
          return;
@@ -43,13 +47,23 @@ namespace fsciosystem {
 
       /**
        * At startup the initial producer may not be one that is registered / elected
-       * and therefore there may be no producer object for them.
+       * and therefore there may be no producer object for them. Producers registered before
+       * the stats table existed get their stats row on the first block they produce, the blocks
+       * they produced before that stay in producer_info::unpaid_blocks until they are paid.
        */
-      auto prod = _producers.find( producer.value );
-      if ( prod != _producers.end() ) {
+      auto stats = _prodstats.find( producer.value );
+      if ( stats != _prodstats.end() ) {
+         _gstate.total_unpaid_blocks++;
+         _prodstats.modify( stats, same_payer, [&](auto& s ) {
+               s.unpaid_blocks++;
+               s.last_block_time = timestamp;
+         });
+      } else if ( _producers.find( producer.value ) != _producers.end() ) {
          _gstate.total_unpaid_blocks++;
-         _producers.modify( prod, same_payer, [&](auto& p ) {
-               p.unpaid_blocks++;
+         _prodstats.emplace( _self, [&](auto& s ) {
+               s.owner           = producer;
+               s.unpaid_blocks   = 1;
+               s.last_block_time = timestamp;
          });
       }
 
@@ -86,7 +100,9 @@ namespace fsciosystem {
 
       fscio_assert( (ct - prod.last_claim_time).count() >= claim_prod_rewards_preiod, "already claimed rewards within past day" );
       distribute_voters_rewards(ct, owner);
-      print("get prpducer rewards, producer is ", name{owner}, "\n");
+      FSCIO_TRACE_PAY( "claimprod producer=", owner,
+                       " block_pay=", prod.rewards_producer_block_pay_balance,
+                       " vote_pay=", prod.rewards_producer_vote_pay_balance );
       if( prod.rewards_producer_block_pay_balance > 0 ) {
          INLINE_ACTION_SENDER(fscio::token, transfer)(
             token_account, { {bpay_account, active_permission}, {owner, active_permission} },
@@ -105,36 +121,41 @@ namespace fsciosystem {
       });
    }
 
-   void system_contract::claimvoter( const name owner, const name producer ) {
-      require_auth( owner );
-      require_activated();
-      print(" ------------- claimvoter ----------------\n");
-      print("owner: ", owner, "\n");
-      print("producer: ", producer, "\n");
-
-      auto ct = current_time_point();
-      int128_t newest_total_voteage = calculate_prod_all_voter_age( producer, ct );
-      
-      const auto& voter = _voters.get( owner.value, "voter not found" );
-      const auto& prod = _producers.get( producer.value, "producer not found" );
-      
-      fscio_assert( ( ct - voter.last_claim_time ).count() >= claim_voter_rewards_preiod, "already claimed rewards within past preiod" );
-
-      votes_table votes_tbl( _self, owner.value );
-      const auto& vts = votes_tbl.get( producer.value, "voter have not add votes to the the producer yet" );
-
-      int128_t newest_voteage = vts.voteage;
-      print("newest_total_voteage = ", newest_total_voteage, "\n");
-      fscio_assert( newest_total_voteage > 0, "claim is not available yet" );
+   bool system_contract::settle_voter_rewards( votes_table& votes_tbl, const vote_info& vts, const producer_info& prod,
+                                               const time_point ct, int64_t& vote_reward, int64_t& block_reward ) {
+      int128_t newest_total_voteage = calculate_prod_all_voter_age( prod, ct );
+      int128_t newest_voteage = calculate_voteage( vts.voteage, vts.vote_num.amount, vts.voteage_update_time, ct );
+      FSCIO_TRACE_PAY( "settle voter=", votes_tbl.get_scope(), " producer=", prod.owner,
+                       " voteage=", newest_voteage, " total_voteage=", newest_total_voteage );
+      vote_reward = 0;
+      block_reward = 0;
+      if( newest_total_voteage <= 0 ) {
+         return false;
+      }
 
       double cut_rate = static_cast<double>( newest_voteage ) / static_cast<double>( newest_total_voteage );
 
-      int64_t vote_reward = static_cast<int64_t>( static_cast<double>( prod.rewards_voters_vote_pay_balance ) * cut_rate );
-      int64_t block_reward = static_cast<int64_t>( static_cast<double>( prod.rewards_voters_block_pay_balance ) * cut_rate );
+      vote_reward = static_cast<int64_t>( static_cast<double>( prod.rewards_voters_vote_pay_balance ) * cut_rate );
+      block_reward = static_cast<int64_t>( static_cast<double>( prod.rewards_voters_block_pay_balance ) * cut_rate );
 
       fscio_assert( 0 <= vote_reward && vote_reward <= prod.rewards_voters_vote_pay_balance, "vote_reward don't count" );
       fscio_assert( 0 <= block_reward && block_reward <= prod.rewards_voters_block_pay_balance, "block_reward don't count" );
 
+      votes_tbl.modify( vts, same_payer, [&]( vote_info & v ) {
+         v.voteage = 0;
+         v.voteage_update_time = ct;
+      });
+
+      _producers.modify( prod, same_payer, [&]( producer_info & p ) {
+         p.rewards_voters_vote_pay_balance -= vote_reward;
+         p.rewards_voters_block_pay_balance -= block_reward;
+         p.total_voteage = newest_total_voteage - newest_voteage;
+         p.voteage_update_time = ct;
+      });
+      return true;
+   }
+
+   void system_contract::pay_voter_rewards( const name owner, int64_t vote_reward, int64_t block_reward ) {
       if( vote_reward > 0 ){
          INLINE_ACTION_SENDER(fscio::token, transfer)(
             token_account, { {vpay_account, active_permission}, {owner, active_permission} },
@@ -148,21 +169,68 @@ namespace fsciosystem {
             { bpay_account, owner, asset(block_reward, core_symbol()), std::string("voter block pay") }
          );
       }
+   }
+
+   void system_contract::claimvoter( const name owner, const name producer ) {
+      require_auth( owner );
+      require_activated();
+
+      auto ct = current_time_point();
+
+      const auto& voter = _voters.get( owner.value, "voter not found" );
+      const auto& prod = _producers.get( producer.value, "producer not found" );
+      
+      fscio_assert( ( ct - voter.last_claim_time ).count() >= claim_voter_rewards_preiod, "already claimed rewards within past preiod" );
+
+      votes_table votes_tbl( _self, owner.value );
+      const auto& vts = votes_tbl.get( producer.value, "voter have not add votes to the the producer yet" );
+
+      int64_t vote_reward = 0;
+      int64_t block_reward = 0;
+      fscio_assert( settle_voter_rewards( votes_tbl, vts, prod, ct, vote_reward, block_reward ), "claim is not available yet" );
+      pay_voter_rewards( owner, vote_reward, block_reward );
       
       _voters.modify( voter, same_payer, [&](auto& v) {
          v.last_claim_time = ct;
       });
+   }
 
-      votes_tbl.modify( vts, same_payer, [&]( vote_info & v ) {
-         v.voteage = 0;
-         v.voteage_update_time = ct;
-      });
+   void system_contract::claimall( const name owner ) {
+      require_auth( owner );
+      require_activated();
 
-      _producers.modify( prod, same_payer, [&]( producer_info & p ) {
-         p.rewards_voters_vote_pay_balance -= vote_reward;
-         p.rewards_voters_block_pay_balance -= block_reward;
-         p.total_voteage = newest_total_voteage - newest_voteage;
-         p.voteage_update_time = ct;
+      auto ct = current_time_point();
+
+      const auto& voter = _voters.get( owner.value, "voter not found" );
+      fscio_assert( ( ct - voter.last_claim_time ).count() >= claim_voter_rewards_preiod, "already claimed rewards within past preiod" );
+
+      /**
+       * Every voted producer is settled exactly like claimvoter would, but the rewards are summed up
+       * and paid with at most one vote pay and one block pay transfer. Producers without a claimable
+       * voteage are skipped instead of failing the whole claim.
+       */
+      votes_table votes_tbl( _self, owner.value );
+      int64_t total_vote_reward = 0;
+      int64_t total_block_reward = 0;
+      bool    settled = false;
+      for( auto vts = votes_tbl.begin(); vts != votes_tbl.end(); ++vts ) {
+         auto prod = _producers.find( vts->producer_name.value );
+         if( prod == _producers.end() ) continue;
+
+         int64_t vote_reward = 0;
+         int64_t block_reward = 0;
+         if( settle_voter_rewards( votes_tbl, *vts, *prod, ct, vote_reward, block_reward ) ) {
+            settled = true;
+            total_vote_reward += vote_reward;
+            total_block_reward += block_reward;
+         }
+      }
+      fscio_assert( settled, "claim is not available yet" );
+      FSCIO_TRACE_PAY( "claimall owner=", owner, " vote_pay=", total_vote_reward, " block_pay=", total_block_reward );
+      pay_voter_rewards( owner, total_vote_reward, total_block_reward );
+
+      _voters.modify( voter, same_payer, [&](auto& v) {
+         v.last_claim_time = ct;
       });
    }
 
@@ -174,24 +242,31 @@ namespace fsciosystem {
       return max_issure_supply * ( min_activated_stake_rate * precision_unit_integer() );
    }
 
+   /**
+    * Settles the buckets and moves the voters' part of the producer's pay into its voter reward balances.
+    * What it costs: up to four inline token actions when the buckets are refilled, then one read and two
+    * writes of the producer row, one read of its prodstats row plus a write when it has blocks to pay, and
+    * a few global state updates. The unpaid blocks are the prodstats counter plus the deprecated
+    * unpaid_blocks still on the producer row, which only adds a field read. None of this visits the
+    * voters: voteage is a running total on the producer row and each voter takes its share lazily in
+    * claimvoter/claimall, so the cost is the same for one voter or a million and no settlement cursor is
+    * needed.
+    */
    void system_contract::distribute_voters_rewards( const time_point distribut_time, const name producer ) {
       require_activated();
       const auto usecs_since_last_fill = (distribut_time - _gstate.last_pervote_bucket_fill).count();
       if ( usecs_since_last_fill > 0 && _gstate.last_pervote_bucket_fill > time_point() ) {
          const asset token_supply = fscio::token::get_supply(token_account, core_symbol().code());
-         print("token_supply is:", token_supply.amount, token_supply.symbol, "\n");
          
          auto new_tokens = static_cast<int64_t>((continuous_rate * static_cast<double>(token_supply.amount) * static_cast<double>(usecs_since_last_fill)) / static_cast<double>(useconds_per_year ));
-         print("new_tokens is:", new_tokens, "\n");
          
          auto to_per_block_pay = static_cast<int64_t>(new_tokens * perblock_rate);
-         print("to_per_block_pay = ", to_per_block_pay, "\n");
 
          auto to_per_vote_pay = static_cast<int64_t>(new_tokens * standby_rate);
-         print("to_per_vote_pay = ", to_per_vote_pay, "\n");
 
          auto to_savings = new_tokens - to_per_block_pay - to_per_vote_pay;
-         print("to_savings = ", to_savings, "\n");
+         FSCIO_TRACE_PAY( "fill buckets supply=", token_supply, " new_tokens=", new_tokens,
+                          " per_block=", to_per_block_pay, " per_vote=", to_per_vote_pay, " savings=", to_savings );
 
          INLINE_ACTION_SENDER(fscio::token, issue)(
             token_account, { {_self, active_permission} },
@@ -226,71 +301,54 @@ namespace fsciosystem {
          const auto last_claim_plus_3days = pitr->last_claim_time + microseconds(3 * useconds_per_day);
          bool crossed_threshold       = (last_claim_plus_3days <= distribut_time);
          bool updated_after_threshold = (last_claim_plus_3days <= pitr->last_votepay_share_update);
-         print(" ------------------update_producer_votepay_share begin---------------- \n");
-         print("updated_after_threshold = ", updated_after_threshold, "\n");
-         print("init_total_votes = ", init_total_votes, "\n");
-         print("crossed_threshold = ", crossed_threshold, "\n");
-         print("updated_after_threshold = ", updated_after_threshold, "\n");
          double new_votepay_share = update_producer_votepay_share( pitr,
                                              distribut_time,
                                              updated_after_threshold ? 0.0 : init_total_votes,
                                              true // reset votepay_share to zero after updating
                                           );
-         print("new_votepay_share = ", new_votepay_share, "\n");
          double total_votepay_share = update_total_votepay_share( distribut_time );
-         print("total_votepay_share = ", total_votepay_share, "\n");
-         print(" ------------------update_producer_votepay_share end---------------- \n");
 
-         print(" ------------------producer_per_vote_pay begin---------------- \n");
-         print("_gstate.pervote_bucket = ", _gstate.pervote_bucket, "\n");
          int64_t producer_per_vote_pay = 0;
          if( total_votepay_share > 0 && !crossed_threshold ) {
             producer_per_vote_pay = int64_t((new_votepay_share * _gstate.pervote_bucket) / total_votepay_share);
             if( producer_per_vote_pay > _gstate.pervote_bucket )
                producer_per_vote_pay = _gstate.pervote_bucket;
          }
-         print("new_votepay_share = ", new_votepay_share, "\n");
          if( producer_per_vote_pay < min_pervote_daily_pay * precision_unit_integer() ) {
             producer_per_vote_pay = 0;
          }
-         print("producer_per_vote_pay = ", producer_per_vote_pay, "\n");
-         print(" ------------------producer_per_vote_pay end---------------- \n");
 
-         print(" ------------------update_producer_blockpay_share begin---------------- \n");
-         uint32_t init_unpaid_blocks = pitr->unpaid_blocks;
+         /// total_unpaid_blocks also counts the blocks still recorded on the producer row itself
+         auto stats = _prodstats.find( producer.value );
+         const uint32_t stats_unpaid_blocks = ( stats != _prodstats.end() ) ? stats->unpaid_blocks : 0;
+         uint32_t init_unpaid_blocks = stats_unpaid_blocks + pitr->unpaid_blocks;
          int64_t producer_per_block_pay = 0;
          if( _gstate.total_unpaid_blocks > 0 ) {
             producer_per_block_pay = ( _gstate.perblock_bucket * init_unpaid_blocks ) / _gstate.total_unpaid_blocks;
          }
-         print("producer_per_block_pay = ", producer_per_block_pay, "\n");
-         print(" ------------------update_producer_blockpay_share end---------------- \n");
 
-         print("producer_per_vote_pay = ", producer_per_vote_pay, "\n");
-         print("producer_per_block_pay = ", producer_per_block_pay, "\n");
-         print("pitr->commission_rate = ", pitr->commission_rate, "\n");
          int64_t to_voters_vote_reward  = static_cast<int64_t>( producer_per_vote_pay * pitr->commission_rate);
          int64_t to_voters_block_reward  = static_cast<int64_t>( producer_per_block_pay * pitr->commission_rate);
-         print("to_voters_vote_reward = ", to_voters_vote_reward, "\n");
-         print("to_voters_block_reward = ", to_voters_block_reward, "\n");
          
-         print("_gstate.pervote_bucket = ", _gstate.pervote_bucket, "\n");
-         print("_gstate.perblock_bucket = ", _gstate.perblock_bucket, "\n");
-         print("_gstate.total_unpaid_blocks = ", _gstate.total_unpaid_blocks, "\n");
          _gstate.pervote_bucket      -= producer_per_vote_pay;
          _gstate.perblock_bucket     -= producer_per_block_pay;
          _gstate.total_unpaid_blocks -= init_unpaid_blocks;
 
-         print(" ------------------end---------------- \n");
-         print("_gstate.pervote_bucket = ", _gstate.pervote_bucket, "\n");
-         print("_gstate.perblock_bucket = ", _gstate.perblock_bucket, "\n");
-         print("_gstate.total_unpaid_blocks = ", _gstate.total_unpaid_blocks, "\n");
+         FSCIO_TRACE_PAY( "distribute producer=", producer,
+                          " crossed_threshold=", crossed_threshold, " updated_after_threshold=", updated_after_threshold,
+                          " votepay_share=", new_votepay_share, " total_votepay_share=", total_votepay_share,
+                          " unpaid_blocks=", init_unpaid_blocks,
+                          " vote_pay=", producer_per_vote_pay, " block_pay=", producer_per_block_pay,
+                          " to_voters_vote=", to_voters_vote_reward, " to_voters_block=", to_voters_block_reward );
 
          update_total_votepay_share( distribut_time, -new_votepay_share, (updated_after_threshold ? init_total_votes : 0.0) );
 
-         print(" ------------------last---------------- \n");
-         print("producer_per_vote_pay = ", producer_per_vote_pay, "\n");
-         print("producer_per_block_pay = ", producer_per_block_pay, "\n");
-         print("init_unpaid_blocks = ", init_unpaid_blocks, "\n");
+
+         if( stats_unpaid_blocks > 0 ) {
+            _prodstats.modify( stats, same_payer, [&](auto &s) {
+               s.unpaid_blocks = 0;
+            });
+         }
 
          _producers.modify(pitr, same_payer, [&](auto &p) {
             p.unpaid_blocks = 0;
@@ -299,10 +357,6 @@ namespace fsciosystem {
             p.rewards_voters_vote_pay_balance += to_voters_vote_reward;
             p.rewards_producer_block_pay_balance += ( producer_per_block_pay - to_voters_block_reward );
             p.rewards_producer_vote_pay_balance += ( producer_per_vote_pay - to_voters_vote_reward );
-            print("p.rewards_voters_block_pay_balance = ", p.rewards_voters_block_pay_balance, "\n");
-            print("p.rewards_voters_vote_pay_balance = ", p.rewards_voters_vote_pay_balance, "\n");
-            print("p.rewards_producer_block_pay_balance = ", p.rewards_producer_block_pay_balance, "\n");
-            print("p.rewards_producer_vote_pay_balance = ", p.rewards_producer_vote_pay_balance, "\n");
          });
       }
    }
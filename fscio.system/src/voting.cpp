@@ -3,6 +3,7 @@
  *  @copyright defined in fsc/LICENSE.txt
  */
 #include <fscio.system/fscio.system.hpp>
+#include <fscio.system/trace.hpp>
 
 #include <fsciolib/fscio.hpp>
 #include <fsciolib/crypto.h>
@@ -91,6 +92,9 @@ namespace fsciosystem {
             info.last_commission_rate_adjustment_time = ct;
             info.last_votepay_share_update = ct;
          });
+         _prodstats.emplace( producer, [&]( producer_stats& stats ){
+            stats.owner = producer;
+         });
       }
    }
 
@@ -133,33 +137,49 @@ namespace fsciosystem {
 
       auto packed_schedule = pack(producers);
 
+      /// the elected set rarely changes, skip proposing the schedule that was proposed last time
+      capi_checksum256 schedule_hash;
+      sha256( packed_schedule.data(), packed_schedule.size(), &schedule_hash );
+      uint64_t fingerprint = 0;
+      memcpy( &fingerprint, schedule_hash.hash, sizeof(fingerprint) );
+      if( global_slots_cleared() && fingerprint == _gstate.last_proposed_schedule_hash ) {
+         return;
+      }
+
+      /// only a schedule the chain accepted is skipped next time, a rejected one is proposed again
       if( set_proposed_producers( packed_schedule.data(),  packed_schedule.size() ) >= 0 ) {
+         _gstate.last_proposed_schedule_hash = fingerprint;
          _gstate.last_producer_schedule_size = static_cast<decltype(_gstate.last_producer_schedule_size)>( top_producers.size() );
       }
    }
 
-   double stake2vote( int64_t staked ) {
+   /**
+    *  The vote weight multiplier 2 ^ ( weeks_since_launch/weeks_per_year ) only changes once a week, so it is
+    *  cached in the global state together with the week it was computed for and only recomputed when the
+    *  week changes. The result is identical to evaluating std::pow on every call.
+    */
+   double system_contract::stake2vote( int64_t staked ) {
       /// TODO subtract 2080 brings the large numbers closer to this decade
-      double weight = int64_t( (now() - (block_timestamp::block_timestamp_epoch / 1000)) / (seconds_per_day * 7) )  / double( 52 );
-      return double(staked) * std::pow( 2, weight );
+      const int64_t weeks = int64_t( (now() - (block_timestamp::block_timestamp_epoch / 1000)) / (seconds_per_day * 7) );
+      if( !global_slots_cleared() ) {
+         return double(staked) * std::pow( 2, weeks / double( 52 ) );
+      }
+      if( _gstate.vote_weight_multiplier == 0 || _gstate.vote_weight_week != static_cast<uint64_t>(weeks) ) {
+         _gstate.vote_weight_week       = static_cast<uint64_t>(weeks);
+         _gstate.vote_weight_multiplier = std::pow( 2, weeks / double( 52 ) );
+      }
+      return double(staked) * _gstate.vote_weight_multiplier;
    }
 
    double system_contract::update_total_votepay_share( time_point ct,
                                                        double additional_shares_delta,
                                                        double shares_rate_delta )
    {
-      print(" ------------------update_total_votepay_share begin---------------- \n");
-      print("additional_shares_delta = ", additional_shares_delta, "\n");
-      print("shares_rate_delta = ", shares_rate_delta, "\n");
       double delta_total_votepay_share = 0.0;
       if( ct > _gstate.last_vpay_state_update ) {
          delta_total_votepay_share = _gstate.total_vpay_share_change_rate
                                        * double( (ct - _gstate.last_vpay_state_update).count() / 1E6 );
       }
-      print("shares_rate_delta = ", shares_rate_delta, "\n");
-      print("delta_total_votepay_share = ", delta_total_votepay_share, "\n");
-      print("_gstate.total_vpay_share_change_rate = ", _gstate.total_vpay_share_change_rate, "\n");
-      print("(ct - _gstate.last_vpay_state_update).count() = ", (ct - _gstate.last_vpay_state_update).count(), "\n");
 
       delta_total_votepay_share += additional_shares_delta;
       if( delta_total_votepay_share < 0 && _gstate.total_producer_votepay_share < -delta_total_votepay_share ) {
@@ -168,17 +188,16 @@ namespace fsciosystem {
          _gstate.total_producer_votepay_share += delta_total_votepay_share;
       }
 
-      print("delta_total_votepay_share = ", delta_total_votepay_share, "\n");
-      print("_gstate.total_producer_votepay_share = ", _gstate.total_producer_votepay_share, "\n");
-
       if( shares_rate_delta < 0 && _gstate.total_vpay_share_change_rate < -shares_rate_delta ) {
          _gstate.total_vpay_share_change_rate = 0.0;
       } else {
          _gstate.total_vpay_share_change_rate += shares_rate_delta;
       }
-      print("_gstate.total_vpay_share_change_rate = ", _gstate.total_vpay_share_change_rate, "\n");
       _gstate.last_vpay_state_update = ct;
-      print(" ------------------update_total_votepay_share end---------------- \n");
+      FSCIO_TRACE_VOTING( "update_total_votepay_share additional_shares_delta=", additional_shares_delta,
+                          " shares_rate_delta=", shares_rate_delta,
+                          " total_votepay_share=", _gstate.total_producer_votepay_share,
+                          " change_rate=", _gstate.total_vpay_share_change_rate );
       return _gstate.total_producer_votepay_share;
    }
 
@@ -205,26 +224,22 @@ namespace fsciosystem {
       return new_votepay_share;
    }
    
-   int128_t system_contract::calculate_prod_all_voter_age( const name producer, const time_point distribut_time ) {
-      int128_t total_voter_age = 0;
-      auto pitr = _producers.find( producer.value );
-      std::vector<name> voters = pitr->voters;
-      std::vector<name>::iterator it = voters.begin();
-      while( it != voters.end() ) {
-         const auto& voter = _voters.get( (*it).value, "voter not found" );
-         votes_table votes_tbl( _self, (*it).value );
-         const auto& vts = votes_tbl.get( producer.value, "voter have not add votes to the the producer yet" );
-         int128_t newest_voteage = static_cast<int128_t>( vts.voteage + (vts.vote_num.amount / precision_unit_integer()) * static_cast<int64_t>( ( distribut_time - vts.voteage_update_time ).count() / voteage_basis ) );
-         
-         votes_tbl.modify( vts, same_payer, [&]( vote_info & v ) {
-            v.voteage = newest_voteage;
-            v.voteage_update_time = distribut_time;
-         });
-
-         total_voter_age += newest_voteage;
-         it++;
+   /**
+    *  Voteage is accumulated in fixed ticks of `voteage_basis` microseconds counted from the epoch, so the
+    *  voteage of every vote and the producer's total advance in lockstep and the total always equals the
+    *  sum of its voters' voteage without having to visit them.
+    */
+   int128_t system_contract::calculate_voteage( int128_t voteage, int64_t vote_amount, time_point last_update, time_point ct ) {
+      const int64_t elapsed_ticks = ct.time_since_epoch().count() / voteage_basis
+                                    - last_update.time_since_epoch().count() / voteage_basis;
+      if( elapsed_ticks <= 0 ) {
+         return voteage;
       }
-      return total_voter_age;
+      return voteage + static_cast<int128_t>( vote_amount / precision_unit_integer() ) * elapsed_ticks;
+   }
+
+   int128_t system_contract::calculate_prod_all_voter_age( const producer_info& prod, const time_point distribut_time ) {
+      return calculate_voteage( prod.total_voteage, prod.total_vote_num.amount, prod.voteage_update_time, distribut_time );
    }
 
    /**
@@ -245,107 +260,202 @@ namespace fsciosystem {
     */
    void system_contract::voteproducer( const name voter_name, const name producer_name, const asset vote_num ) {
       require_auth( voter_name );
-      //validate input
-      print(" voter_name=",name{voter_name}, " producer_name=",name{producer_name}, " vote_num =", vote_num.amount, "\n");
-      fscio_assert( vote_num.symbol == system_contract::get_core_symbol(), "symbol precision mismatch" );
-      fscio_assert( vote_num.is_valid(), "invalid vote_num" );
-      fscio_assert( vote_num.amount >= 0 && vote_num.amount % precision_unit_integer() == 0, "The number of votes must be an integer" );
+      update_votes( voter_name, { { producer_name, vote_num } } );
+   }
 
+   /**
+    *  Sets the votes of 'voter_name' for several producers at once. The allocation is validated as a
+    *  whole against the voter's staked balance, and the voter row and the global vote pay state are
+    *  updated a single time for the whole list.
+    *
+    *  @pre producers must be listed once each, sorted from lowest to highest name
+    */
+   void system_contract::voteproducers( const name voter_name, const std::vector<std::pair<name, asset>>& votes ) {
+      require_auth( voter_name );
+      fscio_assert( !votes.empty(), "must vote for at least one producer" );
+      fscio_assert( votes.size() <= max_producers_per_vote, "attempt to vote for too many producers" );
+      for( size_t i = 1; i < votes.size(); ++i ) {
+         fscio_assert( votes[i-1].first < votes[i].first, "producer votes must be unique and sorted" );
+      }
+
+      update_votes( voter_name, votes );
+   }
+
+   /**
+    *  Each vote replaces the voter's previous vote for that producer: the producer's total votes lose
+    *  the weight of the previous vote and gain the weight of the new one.
+    */
+   void system_contract::update_votes( const name voter_name, const std::vector<std::pair<name, asset>>& votes ) {
       auto voter = _voters.find( voter_name.value );
       fscio_assert( voter != _voters.end(), "user must stake before they can vote" ); /// staking creates voter object
 
-      auto prod = _producers.find(producer_name.value);
-      fscio_assert( prod != _producers.end() && prod->active(), "producer is not registered" );
-
-      int64_t change_votes = 0; /** Increase or decrease voting num */
-      print(" vote_num.amount=", vote_num.amount, "\n");
-      print(" voter->last_vote_weight=", voter->last_vote_weight, "\n");
-      auto new_vote_weight = stake2vote( vote_num.amount );
-      print(" new_vote_weight=", new_vote_weight, "\n");
-      double diff_value = 0.0;
-      if ( voter->last_vote_weight > 0 ) {
-         diff_value -= voter->last_vote_weight;
-      }
-      print(" diff_value=", diff_value, "\n");
-      if( new_vote_weight >= 0 ) {
-         diff_value += new_vote_weight;
-      }
-      print(" diff_value=", diff_value, "\n");
+      const auto ct = current_time_point();
+      const auto unit = precision_unit_integer();
+      const double vote_weight_rate = stake2vote( 1 ); /// vote weight of a single token unit at ct
+
       votes_table votes_tbl( _self, voter_name.value );
-      auto vts = votes_tbl.find( producer_name.value );
-      auto ct = current_time_point();
-      if( vts == votes_tbl.end() ) {
-         fscio_assert( vote_num.amount <= voter->staked_balance.amount , "the balance available for the vote is insufficient" );
-         change_votes = vote_num.amount;
-         votes_tbl.emplace( voter_name,[&]( vote_info & v ) {
-            v.producer_name = producer_name;
-            v.vote_num = vote_num;
-            v.voteage = 0;
-            v.voteage_update_time = ct;
-            v.vote_weight = new_vote_weight;
-         });
-      } else {
-         change_votes = vote_num.amount - vts-> vote_num.amount;
-         fscio_assert( change_votes <= voter-> staked_balance.amount, "need votes change quantity < your staked balance" );
 
-         votes_tbl.modify( vts, same_payer, [&]( vote_info & v ) {
-            v.vote_num = vote_num;
-            v.vote_weight = new_vote_weight;
+      int64_t total_change_votes       = 0; /** Increase or decrease voting num */
+      double  delta_change_rate        = 0.0;
+      double  total_inactive_vpay_share = 0.0;
+
+      for( const auto& [producer_name, vote_num] : votes ) {
+         //validate input
+         fscio_assert( vote_num.symbol == core_symbol(), "symbol precision mismatch" );
+         fscio_assert( vote_num.is_valid(), "invalid vote_num" );
+         fscio_assert( vote_num.amount >= 0 && vote_num.amount % unit == 0, "The number of votes must be an integer" );
+
+         auto prod = _producers.find( producer_name.value );
+         fscio_assert( prod != _producers.end() && prod->active(), "producer is not registered" );
+
+         int64_t change_votes = 0;
+         const double new_vote_weight = double( vote_num.amount ) * vote_weight_rate;
+         double diff_value = new_vote_weight;
+
+         auto vts = votes_tbl.find( producer_name.value );
+         if( vts == votes_tbl.end() ) {
+            change_votes = vote_num.amount;
+            votes_tbl.emplace( voter_name,[&]( vote_info & v ) {
+               v.producer_name = producer_name;
+               v.vote_num = vote_num;
+               v.voteage = 0;
+               v.voteage_update_time = ct;
+               v.vote_weight = new_vote_weight;
+            });
+         } else {
+            change_votes = vote_num.amount - vts->vote_num.amount;
+            diff_value  -= vts->vote_weight;
+
+            votes_tbl.modify( vts, same_payer, [&]( vote_info & v ) {
+               v.voteage = calculate_voteage( v.voteage, v.vote_num.amount, v.voteage_update_time, ct );
+               v.voteage_update_time = ct;
+               v.vote_num = vote_num;
+               v.vote_weight = new_vote_weight;
+            });
+         }
+
+         /// a voter is listed under the producer while its vote is above zero, a vote cast before the
+         /// list existed is added the next time it changes
+         producer_voters_table prod_voters( _self, producer_name.value );
+         auto pv = prod_voters.find( voter_name.value );
+         if( vote_num.amount > 0 && pv == prod_voters.end() ) {
+            prod_voters.emplace( voter_name, [&]( producer_voter & v ) {
+               v.voter = voter_name;
+            });
+         } else if( vote_num.amount == 0 && pv != prod_voters.end() ) {
+            prod_voters.erase( pv );
+         }
+
+         _producers.modify( prod, same_payer, [&]( producer_info & p ) {
+            p.total_voteage         = calculate_prod_all_voter_age( p, ct );
+            p.voteage_update_time   = ct;
+            p.total_vote_num.amount += change_votes;
+            p.total_votes           += diff_value;
+            if ( p.total_votes < 0 ) { // floating point arithmetics can give small negative numbers
+               p.total_votes = 0;
+            }
+            _gstate.total_producer_vote_weight += diff_value;
          });
+
+         double init_total_votes = prod->total_votes;
+         const auto last_claim_plus_3days = prod->last_claim_time + microseconds(3 * useconds_per_day);
+         bool crossed_threshold       = (last_claim_plus_3days <= ct);
+         bool updated_after_threshold = (last_claim_plus_3days <= prod->last_votepay_share_update);
+         // Note: updated_after_threshold implies cross_threshold
+
+         double new_votepay_share = update_producer_votepay_share( prod,
+                                       ct,
+                                       updated_after_threshold ? 0.0 : init_total_votes,
+                                       crossed_threshold && !updated_after_threshold // only reset votepay_share once after threshold
+                                    );
+
+         if( !crossed_threshold ) {
+            delta_change_rate += diff_value;
+         } else if( !updated_after_threshold ) { // TODO
+            total_inactive_vpay_share += new_votepay_share;
+            delta_change_rate -= init_total_votes;// TODO
+         }
+
+         FSCIO_TRACE_VOTING( "vote voter=", voter_name, " producer=", producer_name, " vote_num=", vote_num,
+                             " vote_weight=", new_vote_weight, " diff_value=", diff_value );
+
+         total_change_votes += change_votes;
       }
 
+      fscio_assert( total_change_votes <= voter->staked_balance.amount, "the balance available for the vote is insufficient" );
+
       _voters.modify( voter, same_payer, [&]( voter_info & v ) {
-         v.staked_balance.amount -= change_votes;
-         v.last_vote_weight = new_vote_weight;
+         v.staked_balance.amount -= total_change_votes;
       });
 
-      _producers.modify( prod, same_payer, [&]( producer_info & p ) {
-         p.total_vote_num.amount += change_votes;
-         p.total_voteage         = calculate_prod_all_voter_age( producer_name, ct );
-         p.voteage_update_time   = ct;
-         p.total_votes           += diff_value;
-         if ( p.total_votes < 0 ) { // floating point arithmetics can give small negative numbers
-            p.total_votes = 0;
-         }
-         std::vector<name>::iterator it = find(p.voters.begin(), p.voters.end(), voter_name);
-         if( it == p.voters.end() ){
-            p.voters.push_back (voter_name);
-         }
-         _gstate.total_producer_vote_weight += diff_value;
-      });
+      FSCIO_TRACE_VOTING( "update_votes voter=", voter_name, " change_votes=", total_change_votes,
+                          " inactive_vpay_share=", total_inactive_vpay_share, " delta_change_rate=", delta_change_rate );
+      update_total_votepay_share( ct, -total_inactive_vpay_share, delta_change_rate );
+
+      _gstate.total_activated_stake += total_change_votes;
+      if(_gstate.total_activated_stake < 0){
+         _gstate.total_activated_stake = 0;
+      }
+
+      if( _gstate.total_activated_stake >= get_min_activated_stake() && _gstate.thresh_activated_stake_time == time_point() ) {
+         _gstate.thresh_activated_stake_time = ct;
+      }
+   }
+
+   /**
+    *  Before update_votes subtracted the weight of the replaced vote, it subtracted the voter's last
+    *  vote weight for any producer, so total_votes of producers voted for before the change drifted
+    *  from the votes behind them. This sets total_votes to the sum of the vote weights stored with each
+    *  vote and moves total_producer_vote_weight by the same amount. The voters are the legacy voters
+    *  list plus prodvoters, which together cover every vote ever cast for the producer. Running it again
+    *  changes nothing.
+    */
+   void system_contract::recountvotes( const name producer ) {
+      require_auth( _self );
+
+      auto prod = _producers.find( producer.value );
+      fscio_assert( prod != _producers.end(), "producer not found" );
 
-      double delta_change_rate         = 0.0;
-      double total_inactive_vpay_share = 0.0;
-      double init_total_votes = prod->total_votes;
-      const auto last_claim_plus_3days = prod->last_claim_time + microseconds(3 * useconds_per_day);
-      bool crossed_threshold       = (last_claim_plus_3days <= ct);
-      bool updated_after_threshold = (last_claim_plus_3days <= prod->last_votepay_share_update);
-      // Note: updated_after_threshold implies cross_threshold
+      std::vector<name> voters = prod->voters;
+      producer_voters_table prod_voters( _self, producer.value );
+      for( const auto& pv : prod_voters ) {
+         voters.push_back( pv.voter );
+      }
+      std::sort( voters.begin(), voters.end() );
+      voters.erase( std::unique( voters.begin(), voters.end() ), voters.end() );
+
+      double total_votes = 0;
+      for( const name voter_name : voters ) {
+         votes_table votes_tbl( _self, voter_name.value );
+         auto vts = votes_tbl.find( producer.value );
+         if( vts != votes_tbl.end() ) {
+            total_votes += vts->vote_weight;
+         }
+      }
 
-      double new_votepay_share = update_producer_votepay_share( prod,
-                                    ct,
-                                    updated_after_threshold ? 0.0 : init_total_votes,
-                                    crossed_threshold && !updated_after_threshold // only reset votepay_share once after threshold
-                                 );
+      const auto ct = current_time_point();
+      const double diff_value = total_votes - prod->total_votes;
 
+      /// a producer still accruing votepay share accrues it at its total votes, settle at the old rate first
+      const bool crossed_threshold = ( prod->last_claim_time + microseconds(3 * useconds_per_day) <= ct );
       if( !crossed_threshold ) {
-         delta_change_rate += diff_value;
-      } else if( !updated_after_threshold ) { // TODO
-         total_inactive_vpay_share += new_votepay_share;
-         delta_change_rate -= init_total_votes;// TODO
+         update_producer_votepay_share( prod, ct, prod->total_votes );
       }
 
-      print(" total_inactive_vpay_share=", total_inactive_vpay_share, " delta_change_rate=", delta_change_rate, "\n");
-      update_total_votepay_share( ct, -total_inactive_vpay_share, delta_change_rate );
-      
-      _gstate.total_activated_stake += change_votes;
-      if(_gstate.total_activated_stake < 0){
-         _gstate.total_activated_stake = 0;
+      _producers.modify( prod, same_payer, [&]( producer_info & p ) {
+         p.total_votes = total_votes;
+      });
+      _gstate.total_producer_vote_weight += diff_value;
+      if( _gstate.total_producer_vote_weight < 0 ) { // floating point arithmetics can give small negative numbers
+         _gstate.total_producer_vote_weight = 0;
       }
 
-      if( _gstate.total_activated_stake >= get_min_activated_stake() && _gstate.thresh_activated_stake_time == time_point() ) {
-         _gstate.thresh_activated_stake_time = current_time_point();
+      if( !crossed_threshold ) {
+         update_total_votepay_share( ct, 0.0, diff_value );
       }
+
+      FSCIO_TRACE_VOTING( "recountvotes producer=", producer, " voters=", voters.size(), " total_votes=", total_votes,
+                          " diff_value=", diff_value );
    }
 
 } /// namespace fsciosystem